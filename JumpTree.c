@@ -1,36 +1,613 @@
 #include "JumpTree.h"
 
 #include <math.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
 
-#define JT_INSERTION_THRESHOLD(b, k) (int)(2*pow(floor(b/2), k)) 
-#define JT_DELETION_THRESHOLD(b, k) (int)(2*pow(floor((b-4)/2), k))
+#define JT_MAX_CHILDREN(n, k) (2 * ((int)pow((n) / 2, 1 / (double)(k)) + 2)) // Ensure tree will not exceed height k on rebuild
+#define JT_RADIX_BITS 11 // Three passes cover 32 bit keys
+#define JT_RADIX_BUCKETS (1 << JT_RADIX_BITS)
+#define JT_RADIX_PASSES ((32 + JT_RADIX_BITS - 1) / JT_RADIX_BITS)
+#define JT_RADIX_DIGIT(key, shift) (((unsigned int)(key) ^ 0x80000000u) >> (shift) & (JT_RADIX_BUCKETS - 1)) // Flip sign bit so negative keys sort first
+#define JT_SORT_GROUPS 4 // Digit groups the final sort pass is scattered in, so building overlaps scattering
+#define JT_CACHE_SET(cache, key) (unsigned int)((unsigned long long)((unsigned int)(key) * 2654435761u) << (cache)->set_bits >> 32) // Top set_bits bits of multiplicative hash
+
+static bool JumpTreeCacheLookup(JumpTreeCache *cache, int key, int *value);
+static void JumpTreeCacheFill(JumpTreeCache *cache, int key, int value);
+static void JumpTreeCacheUpdate(JumpTreeCache *cache, int key, int value);
+static void JumpTreeCacheInvalidate(JumpTreeCache *cache, int key);
+static bool JumpTreeBufferWrite(JumpTree *tree, int key, int value, bool tombstone);
+static void JumpTreeUpdateTriggers(JumpTree *tree);
+static int JumpTreeResize(JumpTree *tree, int number_items, bool grow);
+static double JumpTreeShrinkTrigger(const JumpTreePolicy *policy, int b, int k);
+static double JumpTreeHeightGrow(const JumpTreePolicy *policy, int b, int k);
+static double JumpTreeHeightShrink(const JumpTreePolicy *policy, int b, int k);
+static double JumpTreeOccupancyGrow(const JumpTreePolicy *policy, int b, int k);
+static double JumpTreeOccupancyShrink(const JumpTreePolicy *policy, int b, int k);
+static int JumpTreeHeightMaxChildren(const JumpTreePolicy *policy, int number_items, int k);
+static int JumpTreeOccupancyMaxChildren(const JumpTreePolicy *policy, int number_items, int k);
+static JumpTree * JumpTreeInitLike(const JumpTree *model, BTree *internal_tree);
+static void JumpTreeRefit(JumpTree *tree);
+
+const JumpTreePolicy JumpTreeHeightPolicy = { JumpTreeHeightGrow, JumpTreeHeightShrink, JumpTreeHeightMaxChildren, 0.0, 1.0, 1, 0.5 };
+const JumpTreePolicy JumpTreeOccupancyPolicy = { JumpTreeOccupancyGrow, JumpTreeOccupancyShrink, JumpTreeOccupancyMaxChildren, 0.25, 2.0, 4, 0.7 };
+
+typedef struct JumpTreeSortJob {
+	const Key *src; // Input of the current pass
+	Key *dst;
+	int *counts; // Per thread histogram of the current digit, then per thread scatter offsets
+	int *digit_counts; // Per thread histograms of every digit of the input, JT_RADIX_PASSES * JT_RADIX_BUCKETS per thread
+	int shift; // Digit sorted on by the current pass
+	int num_keys;
+	int num_threads;
+	int group_end[JT_SORT_GROUPS]; // Final pass: group g holds digits below group_end[g] not in an earlier group
+	int groups_done[JT_SORT_GROUPS]; // Threads that have scattered group g
+	pthread_mutex_t lock;
+	pthread_cond_t group_scattered;
+} JumpTreeSortJob;
+
+typedef struct JumpTreeSortThread {
+	JumpTreeSortJob *job;
+	int index;
+	int phase; // 0 = histogram all digits, 1 = histogram current digit, 2 = scatter, 3 = scatter final pass by group
+} JumpTreeSortThread;
+
+int JumpTreeFind(JumpTree *tree, const Key *key) {
+	if (tree->delta != NULL) { // Pending writes are newer than the tree
+		const BTreeDeltaEntry *pending = BTreeDeltaFind(tree->delta, key->key);
+		if (pending != NULL) {
+			return pending->tombstone ? -1 : pending->value;
+		}
+	}
+	if (tree->cache == NULL) {
+		return BTreeFind(tree->internal_tree, key);
+	}
+	int value;
+	if (JumpTreeCacheLookup(tree->cache, key->key, &value)) {
+		++tree->cache->hits;
+		return value;
+	}
+	++tree->cache->misses;
+	value = BTreeFind(tree->internal_tree, key);
+	if (value != -1) { // Only cache keys that exist, absent keys would need invalidating on every insert
+		JumpTreeCacheFill(tree->cache, key->key, value);
+	}
+	return value;
+}
 
 bool JumpTreeInsert(JumpTree *tree, const Key *key) {
 	bool rebuilt = false;
-	if (tree->internal_tree->number_items + 1 >= JT_INSERTION_THRESHOLD(tree->internal_tree->max_children, tree->k)) {
+	if (tree->delta != NULL) {
+		rebuilt = JumpTreeBufferWrite(tree, key->key, key->id, false);
+	}
+	else if (tree->internal_tree->number_items + 1 >= tree->grow_at) {
 		//printf("Rebuilding online\n");
-		tree->internal_tree->max_children += 2;//New tree needs to have more children to keep height less than k
+		tree->internal_tree->max_children = JumpTreeResize(tree, tree->internal_tree->number_items + 1, true);//New tree needs to have more children to keep height less than k
 		BTreeRebuildOnline(&(tree->internal_tree));
+		JumpTreeUpdateTriggers(tree);
 		rebuilt = true;
 	}
-	BTreeInsert(tree->internal_tree, key);
+	if (tree->delta == NULL) {
+		BTreeInsert(tree->internal_tree, key);
+	}
+	if (tree->cache != NULL) { // Insert is an upsert, keep a cached copy of the key current
+		JumpTreeCacheUpdate(tree->cache, key->key, key->id);
+	}
 	return rebuilt;
 }
 
 bool JumpTreeDelete(JumpTree *tree, const Key *key) {
 	bool rebuilt = false;
-	if (tree->internal_tree->max_children > 4 && tree->internal_tree->number_items - 1 <= JT_DELETION_THRESHOLD(tree->internal_tree->max_children, tree->k)) {
+	if (tree->delta != NULL) {
+		rebuilt = JumpTreeBufferWrite(tree, key->key, 0, true);
+	}
+	else if (tree->internal_tree->number_items - 1 <= tree->shrink_at) { // shrink_at is INT_MIN once b is 4
 		//printf("Rebuilding online\n");
-		tree->internal_tree->max_children -= 2; // Rebuild only if b > 4 and n below threshold
+		tree->internal_tree->max_children = JumpTreeResize(tree, tree->internal_tree->number_items - 1, false);
 		BTreeRebuildOnline(&(tree->internal_tree));
+		JumpTreeUpdateTriggers(tree);
 		rebuilt =  true;
 	}
-	BTreeDelete(&(tree->internal_tree), key);
+	if (tree->delta == NULL) {
+		BTreeDelete(&(tree->internal_tree), key);
+	}
+	if (tree->cache != NULL) {
+		JumpTreeCacheInvalidate(tree->cache, key->key);
+	}
 	return rebuilt;
 }
 
 void JumpTreeRebuildOffline(JumpTree *tree, const Key *keys, const int k_num_keys) {
-	tree->internal_tree->max_children = 2 * ((int)pow(k_num_keys / 2, 1 / (double)(tree->k)) + 2); // Ensure tree will not exceed height k on rebuild
+	tree->internal_tree->max_children = tree->policy.max_children(&tree->policy, k_num_keys, tree->k);
 
 	BTreeRebuildOffline(&(tree->internal_tree), keys, k_num_keys);
+	JumpTreeUpdateTriggers(tree);
+	JumpTreeCacheClear(tree); // Old contents are gone, online rebuilds keep the cache since no values change
+	if (tree->delta != NULL) { // Pending writes were made against the old contents
+		BTreeDeltaClear(tree->delta);
+	}
+}
+
+static void * JumpTreeSortWorker(void *arg) {
+	JumpTreeSortThread *thread = (JumpTreeSortThread *)arg;
+	JumpTreeSortJob *job = thread->job;
+	int *counts = job->counts + JT_RADIX_BUCKETS * thread->index;
+	int low = (int)((long long)job->num_keys * thread->index / job->num_threads); // Threads split the input by range, not by digit
+	int high = (int)((long long)job->num_keys * (thread->index + 1) / job->num_threads);
+	int i, g;
+	if (thread->phase == 0) { // One read of the input gives every digit's histogram, so constant digits can be skipped
+		int *digits = job->digit_counts + JT_RADIX_PASSES * JT_RADIX_BUCKETS * thread->index;
+		int pass;
+		for (i = low; i < high; ++i) {
+			for (pass = 0; pass < JT_RADIX_PASSES; ++pass) {
+				++digits[JT_RADIX_BUCKETS * pass + JT_RADIX_DIGIT(job->src[i].key, JT_RADIX_BITS * pass)];
+			}
+		}
+	}
+	else if (thread->phase == 1) {
+		memset(counts, 0, JT_RADIX_BUCKETS * sizeof(int));
+		for (i = low; i < high; ++i) {
+			++counts[JT_RADIX_DIGIT(job->src[i].key, job->shift)];
+		}
+	}
+	else if (thread->phase == 2) { // Offsets keep slices in input order so the sort stays stable
+		for (i = low; i < high; ++i) {
+			job->dst[counts[JT_RADIX_DIGIT(job->src[i].key, job->shift)]++] = job->src[i];
+		}
+	}
+	else { // Final pass, one scan of the slice per group so finished groups can be built while later ones scatter
+		int group_start = 0;
+		for (g = 0; g < JT_SORT_GROUPS; ++g) {
+			for (i = low; i < high; ++i) {
+				int digit = JT_RADIX_DIGIT(job->src[i].key, job->shift);
+				if (digit >= group_start && digit < job->group_end[g]) {
+					job->dst[counts[digit]++] = job->src[i];
+				}
+			}
+			group_start = job->group_end[g];
+			pthread_mutex_lock(&job->lock);
+			++job->groups_done[g];
+			pthread_cond_broadcast(&job->group_scattered);
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+	return NULL;
+}
+
+static void JumpTreeSortPhase(JumpTreeSortJob *job, JumpTreeSortThread *threads, pthread_t *ids, bool *started, int phase) {
+	int t;
+	for (t = 0; t < job->num_threads; ++t) {
+		threads[t].phase = phase;
+		started[t] = pthread_create(&ids[t], NULL, JumpTreeSortWorker, &threads[t]) == 0;
+		if (!started[t]) { // Out of threads, do this slice here instead
+			JumpTreeSortWorker(&threads[t]);
+		}
+	}
+	if (phase != 3) { // Final pass is joined once the build has consumed every group
+		for (t = 0; t < job->num_threads; ++t) {
+			if (started[t]) {
+				pthread_join(ids[t], NULL);
+			}
+		}
+	}
+}
+
+static void JumpTreeSortOffsets(JumpTreeSortJob *job, const int *counts, int stride) {
+	// Digit major, thread minor prefix sum of per thread histograms gives every thread its scatter offsets
+	int total = 0, digit, t;
+	for (digit = 0; digit < JT_RADIX_BUCKETS; ++digit) {
+		for (t = 0; t < job->num_threads; ++t) {
+			int count = counts[stride * t + digit];
+			job->counts[JT_RADIX_BUCKETS * t + digit] = total;
+			total += count;
+		}
+	}
+}
+
+static void JumpTreeBuildRun(BTreeBuilder *builder, const Key *run, int n) {
+	int i;
+	for (i = 0; i < n; ++i) {
+		if (i == n - 1 || run[i].key != run[i + 1].key) { // Last writer wins
+			BTreeBuilderAppend(builder, run[i].key, run[i].id);
+		}
+	}
+}
+
+void JumpTreeBuildUnsorted(JumpTree *tree, const Key *keys, const int k_num_keys, int nthreads) {
+	/*
+	 * LSD radix sorts keys JT_RADIX_BITS at a time and bulk loads the tree from the last pass.
+	 * Every pass splits the input into one range per thread, each thread histograms its range and then
+	 * scatters it to offsets from the prefix sum of all histograms, so work is even however keys are
+	 * distributed. Digits that every key shares are skipped. The last pass scatters in JT_SORT_GROUPS
+	 * digit groups of about equal size and this thread builds each group as soon as all threads have
+	 * scattered it. Sorting is stable, so of several equal keys the last one in keys is kept, as if they
+	 * had been inserted in order.
+	 */
+	JumpTreeSortJob job;
+	int t, g, pass, digit;
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+	Key *buffers[2] = { (Key *)malloc(k_num_keys * sizeof(Key)), (Key *)malloc(k_num_keys * sizeof(Key)) };
+	job.src = keys;
+	job.counts = (int *)malloc(JT_RADIX_BUCKETS * nthreads * sizeof(int));
+	job.digit_counts = (int *)calloc(JT_RADIX_PASSES * JT_RADIX_BUCKETS * nthreads, sizeof(int));
+	job.num_keys = k_num_keys;
+	job.num_threads = nthreads;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.group_scattered, NULL);
+	JumpTreeSortThread *threads = (JumpTreeSortThread *)malloc(nthreads * sizeof(JumpTreeSortThread));
+	pthread_t *ids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+	bool *started = (bool *)malloc(nthreads * sizeof(bool));
+	for (t = 0; t < nthreads; ++t) {
+		threads[t].job = &job;
+		threads[t].index = t;
+	}
+
+	JumpTreeSortPhase(&job, threads, ids, started, 0);
+	int passes[JT_RADIX_PASSES], num_passes = 0;
+	for (pass = 0; pass < JT_RADIX_PASSES; ++pass) { // Digit histograms don't depend on order, so constant digits are known up front
+		int largest = 0;
+		for (digit = 0; digit < JT_RADIX_BUCKETS; ++digit) {
+			int count = 0;
+			for (t = 0; t < nthreads; ++t) {
+				count += job.digit_counts[JT_RADIX_PASSES * JT_RADIX_BUCKETS * t + JT_RADIX_BUCKETS * pass + digit];
+			}
+			largest = count > largest ? count : largest;
+		}
+		if (largest < k_num_keys) {
+			passes[num_passes++] = pass;
+		}
+	}
+
+	BTreeBuilder builder;
+	BTreeBuilderInit(&builder, tree->policy.max_children(&tree->policy, k_num_keys, tree->k)); // Duplicates are not known yet, size for all keys
+	for (pass = 0; pass < num_passes; ++pass) {
+		job.shift = JT_RADIX_BITS * passes[pass];
+		job.dst = buffers[pass & 1];
+		if (pass == 0) { // Input histograms are still valid for the first pass
+			JumpTreeSortOffsets(&job, job.digit_counts + JT_RADIX_BUCKETS * passes[pass], JT_RADIX_PASSES * JT_RADIX_BUCKETS);
+		}
+		else {
+			JumpTreeSortPhase(&job, threads, ids, started, 1);
+			JumpTreeSortOffsets(&job, job.counts, JT_RADIX_BUCKETS);
+		}
+		if (pass < num_passes - 1) {
+			JumpTreeSortPhase(&job, threads, ids, started, 2);
+			job.src = job.dst;
+			continue;
+		}
+		int group_start[JT_SORT_GROUPS + 1]; // Output position where each group begins
+		int position = 0;
+		group_start[0] = 0;
+		for (g = 0, digit = 0; g < JT_SORT_GROUPS; ++g) { // Close a group once it holds its share of the keys
+			while (digit < JT_RADIX_BUCKETS && (g == JT_SORT_GROUPS - 1 || position < (long long)k_num_keys * (g + 1) / JT_SORT_GROUPS)) {
+				for (t = 0; t < nthreads; ++t) {
+					position += job.digit_counts[JT_RADIX_PASSES * JT_RADIX_BUCKETS * t + JT_RADIX_BUCKETS * passes[pass] + digit];
+				}
+				++digit;
+			}
+			job.group_end[g] = digit;
+			job.groups_done[g] = 0;
+			group_start[g + 1] = position;
+		}
+		JumpTreeSortPhase(&job, threads, ids, started, 3);
+		for (g = 0; g < JT_SORT_GROUPS; ++g) {
+			pthread_mutex_lock(&job.lock);
+			while (job.groups_done[g] < nthreads) {
+				pthread_cond_wait(&job.group_scattered, &job.lock);
+			}
+			pthread_mutex_unlock(&job.lock);
+			JumpTreeBuildRun(&builder, job.dst + group_start[g], group_start[g + 1] - group_start[g]);
+		}
+		for (t = 0; t < nthreads; ++t) {
+			if (started[t]) {
+				pthread_join(ids[t], NULL);
+			}
+		}
+	}
+	if (num_passes == 0) { // Every key is equal, or there are fewer than two
+		JumpTreeBuildRun(&builder, keys, k_num_keys);
+	}
+
+	bool compress_leaves = tree->internal_tree->compress_leaves;
+	BTreeFree(tree->internal_tree);
+	tree->internal_tree = BTreeBuilderFinish(&builder, compress_leaves);
+	JumpTreeUpdateTriggers(tree);
+	JumpTreeCacheClear(tree);
+	if (tree->delta != NULL) { // Pending writes were made against the old contents
+		BTreeDeltaClear(tree->delta);
+	}
+
+	pthread_cond_destroy(&job.group_scattered);
+	pthread_mutex_destroy(&job.lock);
+	free(started);
+	free(ids);
+	free(threads);
+	free(job.digit_counts);
+	free(job.counts);
+	free(buffers[1]);
+	free(buffers[0]);
+}
+
+static JumpTree * JumpTreeInitLike(const JumpTree *model, BTree *internal_tree) {
+	// New tree around internal_tree with the same k, policy, cache size and write buffer size as model
+	JumpTree *tree = JumpTreeInitK(model->k);
+	BTreeFree(tree->internal_tree);
+	tree->internal_tree = internal_tree;
+	JumpTreeSetPolicy(tree, &model->policy);
+	if (model->cache != NULL) {
+		JumpTreeCacheEnable(tree, (model->cache->set_mask + 1) * JT_CACHE_WAYS);
+	}
+	if (model->delta != NULL) {
+		JumpTreeBufferWrites(tree, model->delta->capacity);
+	}
+	return tree;
+}
+
+JumpTree * JumpTreeMerge(JumpTree *a, JumpTree *b) {
+	JumpTreeFlush(a);
+	JumpTreeFlush(b);
+	int upper_bound = a->internal_tree->number_items + b->internal_tree->number_items;
+	return JumpTreeInitLike(a, BTreeMerge(a->internal_tree, b->internal_tree, a->policy.max_children(&a->policy, upper_bound, a->k)));
+}
+
+void JumpTreeSplit(JumpTree *tree, const Key *key, JumpTree **left, JumpTree **right) {
+	JumpTreeFlush(tree);
+	BTree *left_tree, *right_tree;
+	BTreeSplit(tree->internal_tree, key->key, &left_tree, &right_tree);
+	tree->internal_tree = NULL; // Nodes now belong to the halves
+	*left = JumpTreeInitLike(tree, left_tree);
+	*right = JumpTreeInitLike(tree, right_tree);
+	JumpTreeRefit(*left);
+	JumpTreeRefit(*right);
+	JumpTreeFree(tree);
+}
+
+static void JumpTreeRefit(JumpTree *tree) {
+	/*
+	 * A split half keeps the parent's max_children. If it is already under that b's shrink trigger the capped
+	 * trigger would step it down one rebuild at a time, so rebuild it once at the b the policy picks for its size.
+	 */
+	int b = tree->internal_tree->max_children;
+	int n = tree->internal_tree->number_items;
+	if (b <= 4 || n > JumpTreeShrinkTrigger(&tree->policy, b, tree->k)) {
+		return;
+	}
+	int fitted = tree->policy.max_children(&tree->policy, n, tree->k);
+	if (fitted < b) {
+		tree->internal_tree->max_children = fitted;
+		BTreeRebuildOnline(&(tree->internal_tree));
+		JumpTreeUpdateTriggers(tree);
+	}
+}
+
+void JumpTreeSetPolicy(JumpTree *tree, const JumpTreePolicy *policy) {
+	tree->policy = *policy;
+	JumpTreeUpdateTriggers(tree);
+}
+
+static void JumpTreeUpdateTriggers(JumpTree *tree) {
+	int b = tree->internal_tree->max_children;
+	int n = tree->internal_tree->number_items;
+	double grow = tree->policy.grow_trigger(&tree->policy, b, tree->k);
+	double shrink = floor(JumpTreeShrinkTrigger(&tree->policy, b, tree->k));
+	double shrink_cap = floor(n * (1 - tree->policy.hysteresis)); // A rebuild that left n at or under the shrink trigger would shrink on the next delete
+	if (shrink_cap > n - 2) {
+		shrink_cap = n - 2;
+	}
+	tree->grow_at = grow >= INT_MAX ? INT_MAX : (int)grow; // Triggers for large b or k overflow int
+	if (b <= 4) { // Never shrink below a 2-3-4 tree
+		tree->shrink_at = INT_MIN;
+	}
+	else {
+		shrink = shrink < shrink_cap ? shrink : shrink_cap;
+		tree->shrink_at = shrink >= INT_MAX ? INT_MAX : (int)shrink;
+	}
+}
+
+static int JumpTreeResize(JumpTree *tree, int number_items, bool grow) {
+	// Returns max_children for a rebuild, moving at least one step of 2 and at most max_step steps
+	const JumpTreePolicy *policy = &tree->policy;
+	int b = tree->internal_tree->max_children;
+	int step;
+	if (grow) {
+		b += 2;
+		for (step = 1; step < policy->max_step && policy->grow_trigger(policy, b, tree->k) < number_items * policy->headroom
+			&& number_items > JumpTreeShrinkTrigger(policy, b + 2, tree->k); ++step) { // Stop before b would shrink again
+			b += 2;
+		}
+	}
+	else {
+		b -= 2;
+		for (step = 1; step < policy->max_step && b > 4 && number_items <= JumpTreeShrinkTrigger(policy, b, tree->k); ++step) {
+			b -= 2;
+		}
+	}
+	return b;
+}
+
+static double JumpTreeShrinkTrigger(const JumpTreePolicy *policy, int b, int k) {
+	/*
+	 * Items at or below which b shrinks. Growth leaves headroom times the items under the grow trigger, so the
+	 * shrink trigger is divided by headroom too, otherwise every step past the first would land on it.
+	 */
+	return policy->shrink_trigger(policy, b, k) * (1 - policy->hysteresis) / policy->headroom;
+}
+
+static double JumpTreeHeightGrow(const JumpTreePolicy *policy, int b, int k) {
+	(void)policy;
+	return 2 * pow(b / 2, k);
+}
+
+static double JumpTreeHeightShrink(const JumpTreePolicy *policy, int b, int k) {
+	(void)policy;
+	return 2 * pow((b - 4) / 2, k);
+}
+
+static double JumpTreeOccupancyGrow(const JumpTreePolicy *policy, int b, int k) {
+	return pow(policy->fill * b, k);
+}
+
+static double JumpTreeOccupancyShrink(const JumpTreePolicy *policy, int b, int k) {
+	return pow(policy->fill * (b - 4), k);
+}
+
+static int JumpTreeHeightMaxChildren(const JumpTreePolicy *policy, int number_items, int k) {
+	(void)policy;
+	return JT_MAX_CHILDREN(number_items, k);
+}
+
+static int JumpTreeOccupancyMaxChildren(const JumpTreePolicy *policy, int number_items, int k) {
+	// Smallest even b whose grow trigger leaves headroom, and at least room for the next insert
+	double target = number_items * policy->headroom > number_items + 2.0 ? number_items * policy->headroom : number_items + 2.0;
+	int b = 2 * (int)(pow(target, 1 / (double)k) / policy->fill / 2); // Closed form estimate rounded down to even
+	if (b < 4) {
+		b = 4;
+	}
+	while (policy->grow_trigger(policy, b, k) <= target) {
+		b += 2;
+	}
+	return b;
+}
+
+void JumpTreeBufferWrites(JumpTree *tree, int capacity) {
+	JumpTreeFlush(tree);
+	BTreeDeltaFree(tree->delta);
+	tree->delta = capacity > 0 ? BTreeDeltaInit(capacity) : NULL;
+}
+
+void JumpTreeFlush(JumpTree *tree) {
+	if (tree->delta == NULL || tree->delta->num_entries == 0) {
+		return;
+	}
+	int upper_bound = tree->internal_tree->number_items;
+	int i;
+	for (i = 0; i < tree->delta->num_entries; ++i) {
+		if (!tree->delta->entries[i].tombstone) {
+			++upper_bound;
+		}
+	}
+	if (upper_bound >= tree->grow_at) { // Growing needs a rebuild anyway, fold the delta into it
+		int b = JumpTreeResize(tree, upper_bound, true);
+		int bulk_b = tree->policy.max_children(&tree->policy, upper_bound, tree->k); // A large delta can need more than max_step steps
+		tree->internal_tree->max_children = b > bulk_b ? b : bulk_b;
+		BTreeRebuildMerge(&(tree->internal_tree), tree->delta);
+	}
+	else { // Only the leaves the delta touches are rewritten
+		BTreeApplyDelta(tree->internal_tree, tree->delta);
+		if (tree->internal_tree->number_items <= tree->shrink_at) {
+			tree->internal_tree->max_children = JumpTreeResize(tree, tree->internal_tree->number_items, false);
+			BTreeRebuildOnline(&(tree->internal_tree));
+		}
+	}
+	JumpTreeUpdateTriggers(tree);
+}
+
+static bool JumpTreeBufferWrite(JumpTree *tree, int key, int value, bool tombstone) {
+	// Returns true if the delta was full and had to be merged first
+	if (BTreeDeltaPut(tree->delta, key, value, tombstone)) {
+		return false;
+	}
+	JumpTreeFlush(tree);
+	BTreeDeltaPut(tree->delta, key, value, tombstone);
+	return true;
+}
+
+void JumpTreeCacheEnable(JumpTree *tree, int capacity) {
+	JumpTreeCacheFree(tree->cache);
+	tree->cache = NULL;
+	if (capacity <= 0) { // Disable caching
+		return;
+	}
+	unsigned int num_sets = 1;
+	int set_bits = 0;
+	while (num_sets * JT_CACHE_WAYS < (unsigned int)capacity) {
+		num_sets <<= 1;
+		++set_bits;
+	}
+	tree->cache = (JumpTreeCache *)malloc(sizeof(JumpTreeCache));
+	tree->cache->sets = (JumpTreeCacheSet *)calloc(num_sets, sizeof(JumpTreeCacheSet));
+	tree->cache->set_mask = num_sets - 1;
+	tree->cache->set_bits = set_bits;
+	tree->cache->hits = 0;
+	tree->cache->misses = 0;
+}
+
+void JumpTreeCacheClear(JumpTree *tree) {
+	if (tree->cache == NULL) {
+		return;
+	}
+	unsigned int i;
+	for (i = 0; i <= tree->cache->set_mask; ++i) {
+		tree->cache->sets[i].valid = 0;
+		tree->cache->sets[i].referenced = 0;
+		tree->cache->sets[i].hand = 0;
+	}
+}
+
+void JumpTreeCacheFree(JumpTreeCache *cache) {
+	if (cache != NULL) {
+		free(cache->sets);
+		free(cache);
+	}
+}
+
+static bool JumpTreeCacheLookup(JumpTreeCache *cache, int key, int *value) {
+	JumpTreeCacheSet *set = &cache->sets[JT_CACHE_SET(cache, key)];
+	int i;
+	for (i = 0; i < JT_CACHE_WAYS; ++i) {
+		if ((set->valid & (1 << i)) && set->keys[i] == key) {
+			set->referenced |= 1 << i;
+			*value = set->values[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static void JumpTreeCacheFill(JumpTreeCache *cache, int key, int value) {
+	JumpTreeCacheSet *set = &cache->sets[JT_CACHE_SET(cache, key)];
+	int i;
+	for (i = 0; i < JT_CACHE_WAYS; ++i) { // Prefer an empty way
+		if (!(set->valid & (1 << i))) {
+			break;
+		}
+	}
+	if (i == JT_CACHE_WAYS) { // Set full, advance hand past referenced ways (CLOCK)
+		while (set->referenced & (1 << set->hand)) {
+			set->referenced &= ~(1 << set->hand);
+			set->hand = (set->hand + 1) % JT_CACHE_WAYS;
+		}
+		i = set->hand;
+		set->hand = (set->hand + 1) % JT_CACHE_WAYS;
+	}
+	set->keys[i] = key;
+	set->values[i] = value;
+	set->valid |= 1 << i;
+	set->referenced &= ~(1 << i); // New entries must be hit once before surviving a sweep
+}
+
+static void JumpTreeCacheUpdate(JumpTreeCache *cache, int key, int value) {
+	JumpTreeCacheSet *set = &cache->sets[JT_CACHE_SET(cache, key)];
+	int i;
+	for (i = 0; i < JT_CACHE_WAYS; ++i) {
+		if ((set->valid & (1 << i)) && set->keys[i] == key) {
+			set->values[i] = value;
+			return;
+		}
+	}
+}
+
+static void JumpTreeCacheInvalidate(JumpTreeCache *cache, int key) {
+	JumpTreeCacheSet *set = &cache->sets[JT_CACHE_SET(cache, key)];
+	int i;
+	for (i = 0; i < JT_CACHE_WAYS; ++i) {
+		if ((set->valid & (1 << i)) && set->keys[i] == key) {
+			set->valid &= ~(1 << i);
+			set->referenced &= ~(1 << i);
+			return;
+		}
+	}
 }
@@ -3,6 +3,8 @@
 
 #include "bptree.h"
 
+#define JT_CACHE_WAYS 4
+
 /*
  * JumpTree is a modification of a B- tree 
  * (see "Deletion without Rebalancing in Multiway Search Trees" by Siddhartha Sen and Robert E. Tarjan)
@@ -11,39 +13,125 @@
  * Insert, delete, and search are all O(kn^(1/k)) amortized time complexity.
  */
  
+/*
+ * Optional hot-key cache placed in front of JumpTreeFind.
+ * Set-associative with JT_CACHE_WAYS entries per set, CLOCK replacement within a set.
+ * Only keys present in the tree are cached. Insert updates a cached key in place and delete
+ * invalidates it, so the cache never disagrees with the tree. Online rebuilds keep every
+ * key:value pair, so the cache is carried over; offline rebuilds replace the contents and clear it.
+ */
+
+/*
+ * Optional write buffer (see JumpTreeBufferWrites).
+ * Inserts and deletes (as tombstones) go into a small hashed delta instead of the tree, finds check
+ * the delta before the tree. A full delta is sorted and applied to the leaves it touches, left to right,
+ * so each touched leaf is rewritten once per flush however many writes it received. The flush rebuilds
+ * the whole tree only when the policy says max_children must change.
+ * Successor and predecessor need the merged order and flush the delta first.
+ */
+
+/*
+ * Rebuild policy deciding when insertions grow and deletions shrink max_children.
+ * The triggers are item counts evaluated once per rebuild, so inserts and deletes only compare integers.
+ * JumpTreeHeightPolicy is the worst case height rule, 2(b/2)^k items before growing, which keeps the height
+ * below k however full the nodes are. JumpTreeOccupancyPolicy assumes nodes are fill full on average,
+ * allowing (fill*b)^k items, so it rebuilds less often and keeps b smaller at the risk of an extra level.
+ * Bulk builds (offline rebuild, unsorted build, merge, flushing a delta that grows the tree) take max_children
+ * from the policy's max_children hook. Copy either and adjust the fields to tune it.
+ * After any rebuild the shrink trigger is kept below the item count, by the hysteresis fraction,
+ * so a rebuild is never followed straight away by one in the other direction.
+ */
+
+typedef struct JumpTreePolicy {
+	double (*grow_trigger)(const struct JumpTreePolicy *policy, int max_children, int k); // Grow when items reach this
+	double (*shrink_trigger)(const struct JumpTreePolicy *policy, int max_children, int k); // Shrink when items fall to this
+	int (*max_children)(const struct JumpTreePolicy *policy, int number_items, int k); // max_children for a tree bulk built with this many items
+	double hysteresis; // Fraction below the shrink trigger items must fall before shrinking
+	double headroom; // Growth continues until the grow trigger is at least headroom times the item count, the shrink trigger is divided by it
+	int max_step; // Most steps of 2 max_children may move in one rebuild
+	double fill; // Expected node occupancy, occupancy policy only
+} JumpTreePolicy;
+
+extern const JumpTreePolicy JumpTreeHeightPolicy; // Baseline rule: no hysteresis, single steps
+extern const JumpTreePolicy JumpTreeOccupancyPolicy;
+
+typedef struct JumpTreeCacheSet {
+	int keys[JT_CACHE_WAYS];
+	int values[JT_CACHE_WAYS];
+	unsigned char valid; // Bit i set if way i holds an entry
+	unsigned char referenced; // CLOCK reference bits
+	unsigned char hand; // Next way considered for eviction
+} JumpTreeCacheSet;
+
+typedef struct JumpTreeCache {
+	JumpTreeCacheSet *sets;
+	unsigned int set_mask; // Number of sets - 1, number of sets is a power of 2
+	int set_bits; // log2 of number of sets
+	unsigned long hits;
+	unsigned long misses;
+} JumpTreeCache;
+
+void JumpTreeCacheFree(JumpTreeCache *cache);
+
 typedef struct JumpTree{
 	struct BTree *internal_tree;
+	JumpTreeCache *cache; // NULL if caching is disabled
+	BTreeDelta *delta; // NULL if writes are not buffered
+	JumpTreePolicy policy;
+	int grow_at; // Precomputed from policy on every rebuild
+	int shrink_at;
 	int k;
 } JumpTree;
 
+void JumpTreeFlush(JumpTree *tree); // Merges buffered writes into the tree, no-op if there are none
+void JumpTreeSetPolicy(JumpTree *tree, const JumpTreePolicy *policy);
+
 static inline JumpTree * JumpTreeInit(){
 	JumpTree *tree =  (JumpTree *)malloc(sizeof(JumpTree));
 	tree->internal_tree = BTreeInit();
+	tree->cache = NULL;
+	tree->delta = NULL;
 	tree->k = 5;
+	JumpTreeSetPolicy(tree, &JumpTreeHeightPolicy);
 	return tree;
 }
 
-JumpTree * JumpTreeInitK(int k){
+static inline JumpTree * JumpTreeInitK(int k){
 	JumpTree *tree =  (JumpTree *)malloc(sizeof(JumpTree));
 	tree->internal_tree = BTreeInit();
+	tree->cache = NULL;
+	tree->delta = NULL;
 	tree->k = k;
+	JumpTreeSetPolicy(tree, &JumpTreeHeightPolicy);
 	return tree;
 }
 
 static inline void JumpTreeFree(JumpTree *tree){
 	BTreeFree(tree->internal_tree);
+	JumpTreeCacheFree(tree->cache);
+	BTreeDeltaFree(tree->delta);
 	free(tree);
 }
 
-static inline int JumpTreeFind(JumpTree *tree, const Key *key){ return BTreeFind(tree->internal_tree, key); }
-static inline int JumpTreeSuccessor(JumpTree *tree, const Key *key){ return BTreeSuccessor(tree->internal_tree, key); }
-static inline int JumpTreePredecessor(JumpTree *tree, const Key *key){ return BTreePredecessor(tree->internal_tree, key); }
+static inline int JumpTreeSuccessor(JumpTree *tree, const Key *key){ JumpTreeFlush(tree); return BTreeSuccessor(tree->internal_tree, key); }
+static inline int JumpTreePredecessor(JumpTree *tree, const Key *key){ JumpTreeFlush(tree); return BTreePredecessor(tree->internal_tree, key); }
 static inline int JumpTreeHeight(JumpTree *tree){ return BTreeHeight(tree->internal_tree); }
 static inline void JumpTreePrint(JumpTree *tree){ BTreePrint(tree->internal_tree); }
 static inline double JumpTreeAverageNodeSize(JumpTree *tree){ return BTreeAverageNodeSize(tree->internal_tree);}
+static inline void JumpTreeSetLeafCompression(JumpTree *tree, bool compress){ BTreeSetLeafCompression(tree->internal_tree, compress); }
+static inline double JumpTreeLeafBytesPerKey(JumpTree *tree){ return BTreeLeafBytesPerKey(tree->internal_tree); }
+static inline unsigned long JumpTreeCacheHits(JumpTree *tree){ return tree->cache == NULL ? 0 : tree->cache->hits; }
+static inline unsigned long JumpTreeCacheMisses(JumpTree *tree){ return tree->cache == NULL ? 0 : tree->cache->misses; }
 
+int JumpTreeFind(JumpTree *tree, const Key *key);
 bool JumpTreeInsert(JumpTree *tree, const Key *key);
 bool JumpTreeDelete(JumpTree *tree, const Key *key);
 void JumpTreeRebuildOffline(JumpTree *tree, const Key *keys, const int k_num_keys); //Assumes keys are already sorted
+void JumpTreeBuildUnsorted(JumpTree *tree, const Key *keys, const int k_num_keys, int nthreads); // Replaces contents, duplicate keys keep the last value
+JumpTree * JumpTreeMerge(JumpTree *a, JumpTree *b); // O(n_a + n_b), returns a new tree configured like a, b wins on equal keys
+void JumpTreeSplit(JumpTree *tree, const Key *key, JumpTree **left, JumpTree **right); // Frees tree, left gets keys < key, subtrees are reused
+void JumpTreeCacheEnable(JumpTree *tree, int capacity); // Capacity rounded up to a power of 2 number of sets, 0 disables, resets hit/miss counters
+void JumpTreeCacheClear(JumpTree *tree); // Drops all entries, hit/miss counters are kept
+void JumpTreeBufferWrites(JumpTree *tree, int capacity); // Buffers up to capacity writes between merges, 0 flushes and disables
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+/*
+ * Timing and random numbers shared by the benchmarks. Header only, so each benchmark still builds
+ * from its own source file.
+ */
+
+#include <time.h>
+
+static inline double Now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static inline unsigned int Random(unsigned long long *state) { // xorshift64*, rand() is too coarse for large key counts
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (unsigned int)((*state * 2685821657736338717ull) >> 32);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Write buffer benchmark: inserts into a large tree, direct versus buffered at several delta capacities.
+ * Random inserts scatter over the leaves, appends past the largest key all land in the rightmost leaf.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -o buffered_insert bench/buffered_insert.c JumpTree.c bptree.c -lm -pthread
+ * Usage: ./buffered_insert [num_keys] [num_inserts]
+ */
+
+#include "../JumpTree.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+	int num_keys = argc > 1 ? atoi(argv[1]) : 2000000;
+	int num_inserts = argc > 2 ? atoi(argv[2]) : 200000;
+	const int capacities[] = { 0, 1024, 8192, 65536, 262144 }; // 0 is direct inserts
+	int i, c;
+
+	Key *keys = (Key *)malloc(num_keys * sizeof(Key));
+	for (i = 0; i < num_keys; ++i) { // Even keys in the tree, random inserts use odd keys so every insert adds an item
+		keys[i].key = 2 * i;
+		keys[i].id = i;
+	}
+	Key *inserts = (Key *)malloc(num_inserts * sizeof(Key));
+	unsigned long long state = 88172645463325252ull;
+	const char *names[] = { "random", "append" };
+	int w;
+
+	printf("keys %d, inserts %d\n", num_keys, num_inserts);
+	printf("%-8s %10s %12s %8s\n", "inserts", "capacity", "seconds", "speedup");
+	for (w = 0; w < 2; ++w) {
+		for (i = 0; i < num_inserts; ++i) {
+			inserts[i].key = w == 0 ? 2 * (int)(Random(&state) % num_keys) + 1 : 2 * (num_keys + i);
+			inserts[i].id = i;
+		}
+		double direct = 0;
+		for (c = 0; c < (int)(sizeof(capacities) / sizeof(capacities[0])); ++c) {
+			JumpTree *tree = JumpTreeInit();
+			JumpTreeRebuildOffline(tree, keys, num_keys);
+			JumpTreeBufferWrites(tree, capacities[c]);
+			double start = Now();
+			for (i = 0; i < num_inserts; ++i) {
+				JumpTreeInsert(tree, &inserts[i]);
+			}
+			JumpTreeFlush(tree);
+			double elapsed = Now() - start;
+			if (c == 0) {
+				direct = elapsed;
+			}
+			for (i = 0; i < num_inserts; ++i) { // Later inserts of a repeated key win, check against the last write
+				Key key = { inserts[i].key, 0 };
+				if (JumpTreeFind(tree, &key) < inserts[i].id) {
+					printf("capacity %d lost insert of key %d\n", capacities[c], inserts[i].key);
+					return 1;
+				}
+			}
+			printf("%-8s %10d %12.3f %7.2fx\n", names[w], capacities[c], elapsed, direct / elapsed);
+			JumpTreeFree(tree);
+		}
+	}
+
+	free(inserts);
+	free(keys);
+	return 0;
+}
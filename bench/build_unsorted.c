@@ -0,0 +1,87 @@
+/*
+ * Unsorted bulk load benchmark: JumpTreeBuildUnsorted with 1 to max_threads threads, for keys spread over
+ * the whole int range and for small keys that all share their top byte. Speedups are against the baseline
+ * of sorting a copy with qsort, dropping repeated keys and calling JumpTreeRebuildOffline.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -o build_unsorted bench/build_unsorted.c JumpTree.c bptree.c -lm -pthread
+ * Usage: ./build_unsorted [num_keys] [max_threads]
+ */
+
+#include "../JumpTree.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int CompareKeys(const void *a, const void *b) { // By key, then id so the last write of a key sorts last
+	const Key *x = (const Key *)a, *y = (const Key *)b;
+	if (x->key != y->key) {
+		return x->key < y->key ? -1 : 1;
+	}
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+static int Check(JumpTree *tree, const Key *keys, int num_keys, const char *name) {
+	int i;
+	for (i = 0; i < num_keys; i += 997) { // Spot check, a repeated key keeps a later id
+		if (JumpTreeFind(tree, &keys[i]) < keys[i].id) {
+			printf("%s lost key %d\n", name, keys[i].key);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int num_keys = argc > 1 ? atoi(argv[1]) : 10000000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+	const char *names[] = { "full range", "below 2^24" };
+	unsigned long long state = 88172645463325252ull;
+	int i, d, threads;
+
+	Key *keys = (Key *)malloc(num_keys * sizeof(Key));
+	Key *sorted = (Key *)malloc(num_keys * sizeof(Key));
+	printf("keys %d\n", num_keys);
+	printf("%-12s %8s %10s %8s\n", "keys", "threads", "seconds", "speedup");
+	for (d = 0; d < 2; ++d) {
+		for (i = 0; i < num_keys; ++i) {
+			unsigned int key = Random(&state);
+			keys[i].key = d == 0 ? (int)key : (int)(key >> 8);
+			keys[i].id = i;
+		}
+		JumpTree *tree = JumpTreeInit();
+		double start = Now();
+		memcpy(sorted, keys, num_keys * sizeof(Key));
+		qsort(sorted, num_keys, sizeof(Key), CompareKeys);
+		int unique = 0;
+		for (i = 0; i < num_keys; ++i) { // Offline rebuilds need unique keys, keep the last write of each
+			if (unique > 0 && sorted[unique - 1].key == sorted[i].key) {
+				--unique;
+			}
+			sorted[unique++] = sorted[i];
+		}
+		JumpTreeRebuildOffline(tree, sorted, unique);
+		double baseline = Now() - start;
+		if (Check(tree, keys, num_keys, "qsort + offline")) {
+			return 1;
+		}
+		printf("%-12s %8s %10.3f %7.2fx\n", names[d], "qsort", baseline, 1.0);
+		JumpTreeFree(tree);
+		for (threads = 1; threads <= max_threads; threads *= 2) {
+			tree = JumpTreeInit();
+			start = Now();
+			JumpTreeBuildUnsorted(tree, keys, num_keys, threads);
+			double elapsed = Now() - start;
+			if (Check(tree, keys, num_keys, "unsorted build")) {
+				return 1;
+			}
+			printf("%-12s %8d %10.3f %7.2fx\n", names[d], threads, elapsed, baseline / elapsed);
+			JumpTreeFree(tree);
+		}
+	}
+
+	free(sorted);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Hot-key cache benchmark: JumpTreeFind under Zipf distributed keys, with and without the cache.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -o cache_zipf bench/cache_zipf.c JumpTree.c bptree.c -lm -pthread
+ * Usage: ./cache_zipf [num_keys] [num_lookups] [cache_capacity]
+ */
+
+#include "../JumpTree.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <math.h>
+
+static void ZipfSample(int *ranks, int num_samples, int num_keys, double skew, unsigned long long *state) {
+	// Inverse CDF sampling, rank r is drawn with probability proportional to 1/(r+1)^skew
+	double *cdf = (double *)malloc(num_keys * sizeof(double));
+	double total = 0;
+	int i;
+	for (i = 0; i < num_keys; ++i) {
+		total += 1 / pow(i + 1, skew);
+		cdf[i] = total;
+	}
+	for (i = 0; i < num_samples; ++i) {
+		double u = Random(state) / 4294967296.0 * total;
+		int low = 0, high = num_keys - 1;
+		while (low < high) {
+			int mid = low + (high - low) / 2;
+			if (cdf[mid] < u) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+		ranks[i] = low;
+	}
+	free(cdf);
+}
+
+int main(int argc, char **argv) {
+	int num_keys = argc > 1 ? atoi(argv[1]) : 1000000;
+	int num_lookups = argc > 2 ? atoi(argv[2]) : 5000000;
+	int capacity = argc > 3 ? atoi(argv[3]) : 16384;
+	const double skews[] = { 0.0, 0.6, 0.8, 0.99, 1.2, 1.5 };
+	unsigned long long state = 88172645463325252ull;
+	int i, s;
+
+	Key *keys = (Key *)malloc(num_keys * sizeof(Key));
+	int *hot = (int *)malloc(num_keys * sizeof(int)); // Rank to key, shuffled so hot keys are spread over the tree
+	for (i = 0; i < num_keys; ++i) {
+		keys[i].key = 3 * i;
+		keys[i].id = i;
+		hot[i] = 3 * i;
+	}
+	for (i = num_keys - 1; i > 0; --i) {
+		int j = Random(&state) % (i + 1);
+		int swap = hot[i];
+		hot[i] = hot[j];
+		hot[j] = swap;
+	}
+	int *ranks = (int *)malloc(num_lookups * sizeof(int));
+	JumpTree *tree = JumpTreeInit();
+	JumpTreeRebuildOffline(tree, keys, num_keys);
+
+	printf("keys %d, lookups %d, cache capacity %d\n", num_keys, num_lookups, capacity);
+	printf("%6s %12s %12s %9s %8s\n", "skew", "uncached s", "cached s", "hit rate", "speedup");
+	for (s = 0; s < (int)(sizeof(skews) / sizeof(skews[0])); ++s) {
+		ZipfSample(ranks, num_lookups, num_keys, skews[s], &state);
+		long long checksum[2] = { 0, 0 };
+		double elapsed[2];
+		int cached;
+		for (cached = 0; cached < 2; ++cached) {
+			JumpTreeCacheEnable(tree, cached ? capacity : 0);
+			double start = Now();
+			for (i = 0; i < num_lookups; ++i) {
+				Key key = { hot[ranks[i]], 0 };
+				checksum[cached] += JumpTreeFind(tree, &key);
+			}
+			elapsed[cached] = Now() - start;
+		}
+		if (checksum[0] != checksum[1]) {
+			printf("cached and uncached lookups disagree\n");
+			return 1;
+		}
+		double hit_rate = (double)JumpTreeCacheHits(tree) / (JumpTreeCacheHits(tree) + JumpTreeCacheMisses(tree));
+		printf("%6.2f %12.3f %12.3f %8.1f%% %7.2fx\n", skews[s], elapsed[0], elapsed[1], 100 * hit_rate, elapsed[0] / elapsed[1]);
+	}
+
+	JumpTreeFree(tree);
+	free(ranks);
+	free(hot);
+	free(keys);
+	return 0;
+}
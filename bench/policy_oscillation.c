@@ -0,0 +1,73 @@
+/*
+ * Rebuild policy benchmark: grows a tree by sequential inserts and, right after every growth rebuild,
+ * alternates deleting and reinserting the newest key. A policy that leaves the shrink trigger at or above
+ * the item count rebuilds on every one of those operations.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -o policy_oscillation bench/policy_oscillation.c JumpTree.c bptree.c -lm -pthread
+ * Usage: ./policy_oscillation [num_keys] [cycles_per_threshold]
+ */
+
+#include "../JumpTree.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+
+static int Run(const char *name, const JumpTreePolicy *policy, int k, int num_keys, int cycles) {
+	JumpTree *tree = JumpTreeInitK(k);
+	JumpTreeSetPolicy(tree, policy);
+	int growths = 0, thrashing = 0, oscillation_rebuilds = 0;
+	double elapsed = 0;
+	int i, c;
+	for (i = 0; i < num_keys; ++i) {
+		Key key = { i, i };
+		if (!JumpTreeInsert(tree, &key)) {
+			continue;
+		}
+		++growths;
+		int rebuilds = 0;
+		double start = Now();
+		for (c = 0; c < cycles; ++c) { // Sit on the threshold that was just crossed
+			rebuilds += JumpTreeDelete(tree, &key);
+			rebuilds += JumpTreeInsert(tree, &key);
+		}
+		elapsed += Now() - start;
+		oscillation_rebuilds += rebuilds;
+		if (rebuilds > 0) {
+			++thrashing;
+		}
+	}
+	for (i = 0; i < num_keys; ++i) {
+		Key key = { i, 0 };
+		if (JumpTreeFind(tree, &key) != i) {
+			printf("%s lost key %d\n", name, i);
+			return 1;
+		}
+	}
+	printf("%-28s %2d %7d %10d %12d %10.3f %4d\n", name, k, growths, thrashing, oscillation_rebuilds, elapsed, tree->internal_tree->max_children);
+	JumpTreeFree(tree);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int num_keys = argc > 1 ? atoi(argv[1]) : 200000;
+	int cycles = argc > 2 ? atoi(argv[2]) : 100;
+	JumpTreePolicy stepped = JumpTreeHeightPolicy;
+	stepped.headroom = 2.0;
+	stepped.max_step = 4;
+	JumpTreePolicy stepped_hysteresis = stepped;
+	stepped_hysteresis.hysteresis = 0.25;
+	int k;
+
+	printf("keys %d, %d delete/insert cycles after each growth\n", num_keys, cycles);
+	printf("%-28s %2s %7s %10s %12s %10s %4s\n", "policy", "k", "growths", "thrashing", "rebuilds", "seconds", "b");
+	for (k = 3; k <= 5; ++k) {
+		if (Run("height", &JumpTreeHeightPolicy, k, num_keys, cycles)
+			|| Run("height headroom 2 step 4", &stepped, k, num_keys, cycles)
+			|| Run("  with hysteresis 0.25", &stepped_hysteresis, k, num_keys, cycles)
+			|| Run("occupancy", &JumpTreeOccupancyPolicy, k, num_keys, cycles)) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -1,17 +1,42 @@
 ﻿#include "bptree.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define TREE_HEIGHT_THRESHOLD(n, b) (int)(log(n/b)/log(ceil(b/2)))+4
 #define BTREE_MAX_SPACE_CONSUMPTION(n) 0
 #define BTREE_SPACE_THRESHOLD(n) 0
 
-static void BTreeSplitChild(BTree *tree, BTreeNode *parent, int child_index);
+static void BTreeSplitChild(BTree *tree, BTreeNode *parent, int child_index, int pending_key);
 static void BTreeInsertRecursive(BTree *tree, BTreeNode *current, const Key *key);
 static void BTreeDeleteRecursion(BTree *tree, BTreeNode *current, const Key *key);
 static void BTreePrintRecursive(BTree *tree, BTreeNode *current);
 static double BTreeAverageNodeSizeRecursive(BTreeNode *current, double *total_nodes);
+static int BTreeLeafSearch(const BTreeNode *leaf, int key);
+static bool BTreeLeafEncode(BTreeNode *leaf);
+static void BTreeLeafDecode(BTree *tree, BTreeNode *leaf);
+static void BTreeEncodeLeaves(BTree *tree);
+static int BTreeHeightTrigger(int height, int max_children);
+static void BTreeSplitRecursive(BTree *tree, BTreeNode *current, int key, BTreeNode **left, BTreeNode **right);
+
+static inline int BTreeLeafKey(const BTreeNode *leaf, int i) {
+	if (leaf->key_width == 0) {
+		return leaf->values[i].key;
+	}
+	else if (leaf->key_width == 1) {
+		return leaf->key_base + ((const unsigned char *)leaf->packed_keys)[i];
+	}
+	return leaf->key_base + ((const unsigned short *)leaf->packed_keys)[i];
+}
+
+static inline int BTreeLeafValue(const BTreeNode *leaf, int i) {
+	return leaf->key_width == 0 ? leaf->values[i].value : leaf->ids[i];
+}
 
 BTreeNode * BTreeNodeInit(bool internal) {
 	BTreeNode *node = (BTreeNode *)malloc(sizeof(BTreeNode));
@@ -25,6 +50,10 @@ BTreeNode * BTreeNodeInit(bool internal) {
 		node->children = (BTreeNode **)calloc(DEFAULT_MAX_CHILDREN, sizeof(BTreeNode *));
 		node->values = NULL;
 	}
+	node->ids = NULL;
+	node->packed_keys = NULL;
+	node->key_base = 0;
+	node->key_width = 0;
 	node->next = NULL;
 	node->previous = NULL;
 	node->id = rand();
@@ -43,6 +72,10 @@ BTreeNode * BTreeNodeInitM(bool internal, int max_children) {
 		node->children = (BTreeNode **)calloc(max_children, sizeof(BTreeNode *));
 		node->values = NULL;
 	}
+	node->ids = NULL;
+	node->packed_keys = NULL;
+	node->key_base = 0;
+	node->key_width = 0;
 	node->next = NULL;
 	node->previous = NULL;
 	node->id = rand();
@@ -58,12 +91,104 @@ void BTreeNodeFree(BTreeNode *node) {
 	}
 	else {//Leaf, has values
 		free(node->values);
+		free(node->ids); // Encoded leaf
+		free(node->packed_keys);
 	}
 	free(node->keys);
 	free(node);
 }
 
 
+BTreeDelta * BTreeDeltaInit(int capacity) {
+	BTreeDelta *delta = (BTreeDelta *)malloc(sizeof(BTreeDelta));
+	delta->entries = (BTreeDeltaEntry *)malloc(capacity * sizeof(BTreeDeltaEntry));
+	delta->index_bits = 1;
+	while ((1 << delta->index_bits) < 2 * capacity) { ++delta->index_bits; } // Keep load factor at most 1/2
+	delta->index = (int *)malloc((1 << delta->index_bits) * sizeof(int));
+	delta->capacity = capacity;
+	BTreeDeltaClear(delta);
+	return delta;
+}
+
+void BTreeDeltaFree(BTreeDelta *delta) {
+	if (delta != NULL) {
+		free(delta->entries);
+		free(delta->index);
+		free(delta);
+	}
+}
+
+void BTreeDeltaClear(BTreeDelta *delta) {
+	memset(delta->index, 0xFF, (1 << delta->index_bits) * sizeof(int)); // All slots -1
+	delta->num_entries = 0;
+}
+
+static int BTreeDeltaSlot(const BTreeDelta *delta, int key) {
+	// Linear probing, returns the slot holding key or the empty slot where it would go
+	unsigned int mask = (1u << delta->index_bits) - 1;
+	unsigned int slot = ((unsigned int)key * 2654435761u) >> (32 - delta->index_bits);
+	while (delta->index[slot] != -1 && delta->entries[delta->index[slot]].key != key) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+bool BTreeDeltaPut(BTreeDelta *delta, int key, int value, bool tombstone) {
+	int slot = BTreeDeltaSlot(delta, key);
+	if (delta->index[slot] == -1) { // New key, append
+		if (delta->num_entries == delta->capacity) {
+			return false;
+		}
+		delta->index[slot] = delta->num_entries++;
+	}
+	BTreeDeltaEntry *entry = &delta->entries[delta->index[slot]];
+	entry->key = key;
+	entry->value = value;
+	entry->tombstone = tombstone;
+	return true;
+}
+
+const BTreeDeltaEntry * BTreeDeltaFind(const BTreeDelta *delta, int key) {
+	int slot = BTreeDeltaSlot(delta, key);
+	return delta->index[slot] == -1 ? NULL : &delta->entries[delta->index[slot]];
+}
+
+static void BTreeDeltaSort(BTreeDelta *delta) {
+	/*
+	 * LSD radix sort on the key bytes, digits every entry shares are skipped (usually the high bytes).
+	 * Only done right before the delta is emptied, sorting invalidates the hash index.
+	 */
+	BTreeDeltaEntry *src = delta->entries;
+	BTreeDeltaEntry *dst = (BTreeDeltaEntry *)malloc(delta->num_entries * sizeof(BTreeDeltaEntry));
+	int shift, i;
+	for (shift = 0; shift < 32; shift += 8) {
+		int counts[256] = { 0 };
+		for (i = 0; i < delta->num_entries; ++i) {
+			++counts[((unsigned int)src[i].key ^ 0x80000000u) >> shift & 0xFF]; // Flip sign bit so negative keys sort first
+		}
+		if (delta->num_entries == 0 || counts[((unsigned int)src[0].key ^ 0x80000000u) >> shift & 0xFF] == delta->num_entries) {
+			continue;
+		}
+		int offset = 0, digit;
+		for (digit = 0; digit < 256; ++digit) {
+			int count = counts[digit];
+			counts[digit] = offset;
+			offset += count;
+		}
+		for (i = 0; i < delta->num_entries; ++i) {
+			dst[counts[((unsigned int)src[i].key ^ 0x80000000u) >> shift & 0xFF]++] = src[i];
+		}
+		BTreeDeltaEntry *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != delta->entries) {
+		memcpy(delta->entries, src, delta->num_entries * sizeof(BTreeDeltaEntry));
+		dst = src;
+	}
+	free(dst);
+}
+
 BTree * BTreeInit() {
 	BTree *tree = (BTree*)malloc(sizeof(BTree));
 	tree->root = NULL;
@@ -72,6 +197,9 @@ BTree * BTreeInit() {
 	tree->height = -1;
 	tree->number_items = 0;
 	tree->num_leaves = 0;
+	tree->compress_leaves = false;
+	tree->balance_height = -2; // No trigger computed yet
+	tree->balance_items = 0;
 	return tree;
 }
 
@@ -83,6 +211,9 @@ BTree * BTreeInitM(int max_children) {
 	tree->height = -1;
 	tree->number_items = 0;
 	tree->num_leaves = 0;
+	tree->compress_leaves = false;
+	tree->balance_height = -2; // No trigger computed yet
+	tree->balance_items = 0;
 	return tree;
 }
 
@@ -109,106 +240,448 @@ void BTreeFree(BTree *tree) {
 	}
 }
 
-void BTreeRebuildOnline(BTree **tree) { 
+void BTreeBuilderInit(BTreeBuilder *builder, int max_children) {
 	//Initialize empty tree while anticipating insert
-	BTree *new_tree = BTreeInitM((*tree)->max_children);
-	new_tree->min = new_tree->root = BTreeNodeInitM(false, new_tree->max_children);
-	new_tree->height = 0;
-	new_tree->num_leaves = 1;
-
-	int *right_spine = (int *)calloc((*tree)->height + 2, sizeof(int));
+	builder->tree = BTreeInitM(max_children);
+	builder->tree->min = builder->tree->root = BTreeNodeInitM(false, max_children);
+	builder->tree->height = 0;
+	builder->tree->num_leaves = 1;
+	builder->spine_size = 4;
+	builder->right_spine = (int *)calloc(builder->spine_size, sizeof(int));
+}
 
-	BTreeNode *current = (*tree)->min;
+void BTreeBuilderAppend(BTreeBuilder *builder, int key, int value) {
+	BTree *new_tree = builder->tree;
+	int *right_spine;
 	BTreeNode *iter = NULL;
-	while (current != NULL) {
-		int i, j;
-		for (i = 0; i < current->num_children; ++i) {
-			if (new_tree->root->num_children == new_tree->max_children) { // Root needs to be split
-				BTreeNode *new_root = BTreeNodeInitM(true, new_tree->max_children);
-				++new_tree->height;
-				new_root->num_children = 1;
-				new_root->children[0] = new_tree->root;
-				new_tree->root = new_root;
-				BTreeSplitChild(new_tree, new_root, 0);
-				right_spine[new_tree->height] = 1;
-				right_spine[new_tree->height - 1] -= (new_tree->max_children + 1) / 2;
-			}
-			iter = new_tree->root;
-			for (j = new_tree->height; j > 0; j--) { // Split right spine if needs to be split (excluding root)
-				if (iter->children[right_spine[j]]->num_children == new_tree->max_children) { // Need to split
-					BTreeSplitChild(new_tree, iter, right_spine[j]);
-					++right_spine[j];
-					right_spine[j - 1] -= (new_tree->max_children + 1) / 2;
-				}
-				iter = iter->children[right_spine[j]];
-			}
-			if (iter->children != NULL) {
-				iter = iter->children[right_spine[j]];
+	int j;
+	if (new_tree->root->num_children == new_tree->max_children) { // Root needs to be split
+		if (new_tree->height + 2 > builder->spine_size) {
+			builder->right_spine = (int *)realloc(builder->right_spine, 2 * builder->spine_size * sizeof(int));
+			for (j = builder->spine_size; j < 2 * builder->spine_size; ++j) {
+				builder->right_spine[j] = 0;
 			}
-			if (iter->num_children != 0) {
-				iter->keys[iter->num_children - 1] = iter->values[iter->num_children - 1].key;
-			}
-			iter->values[iter->num_children++] = current->values[i];
+			builder->spine_size *= 2;
+		}
+		BTreeNode *new_root = BTreeNodeInitM(true, new_tree->max_children);
+		++new_tree->height;
+		new_root->num_children = 1;
+		new_root->children[0] = new_tree->root;
+		new_tree->root = new_root;
+		BTreeSplitChild(new_tree, new_root, 0, key);
+		builder->right_spine[new_tree->height] = 1;
+		builder->right_spine[new_tree->height - 1] -= (new_tree->max_children + 1) / 2;
+	}
+	right_spine = builder->right_spine;
+	iter = new_tree->root;
+	for (j = new_tree->height; j > 0; j--) { // Split right spine if needs to be split (excluding root)
+		if (iter->children[right_spine[j]]->num_children == new_tree->max_children) { // Need to split
+			BTreeSplitChild(new_tree, iter, right_spine[j], key);
 			++right_spine[j];
-			++new_tree->number_items;
+			right_spine[j - 1] -= (new_tree->max_children + 1) / 2;
 		}
-		current = current->next;
+		iter = iter->children[right_spine[j]];
+	}
+	if (iter->children != NULL) {
+		iter = iter->children[right_spine[j]];
 	}
-	free(right_spine);
+	if (iter->num_children != 0) {
+		iter->keys[iter->num_children - 1] = iter->values[iter->num_children - 1].key;
+	}
+	iter->values[iter->num_children].key = key;
+	iter->values[iter->num_children].value = value;
+	++iter->num_children;
+	++right_spine[j];
+	++new_tree->number_items;
+}
+
+BTree * BTreeBuilderFinish(BTreeBuilder *builder, bool compress_leaves) {
+	free(builder->right_spine);
+	builder->right_spine = NULL;
+	builder->tree->compress_leaves = compress_leaves; // Leaves are appended to while building, encode once at the end
+	if (builder->tree->number_items == 0) { // Nothing appended, drop the empty root leaf so the tree is empty like BTreeInit
+		BTreeNodeFree(builder->tree->root);
+		builder->tree->root = NULL;
+		builder->tree->min = NULL;
+		builder->tree->height = -1;
+		builder->tree->num_leaves = 0;
+	}
+	BTreeEncodeLeaves(builder->tree);
+	return builder->tree;
+}
+
+void BTreeRebuildOnline(BTree **tree) { 
+	BTreeBuilder builder;
+	BTreeBuilderInit(&builder, (*tree)->max_children);
+	BTreeNode *current;
+	int i;
+	for (current = (*tree)->min; current != NULL; current = current->next) {
+		for (i = 0; i < current->num_children; ++i) {
+			BTreeBuilderAppend(&builder, BTreeLeafKey(current, i), BTreeLeafValue(current, i));
+		}
+	}
+	BTree *new_tree = BTreeBuilderFinish(&builder, (*tree)->compress_leaves);
 	BTreeFree(*tree); // Free memory for old tree
 	*tree = new_tree;
 }// For rebuilding after insertions or deletions
 
 void BTreeRebuildOffline(BTree **tree, const Key *keys, const int k_num_keys) {
-	BTree *new_tree = BTreeInitM((*tree)->max_children);
-	new_tree->min = new_tree->root = BTreeNodeInitM(false, new_tree->max_children);
-	new_tree->height = 0;
-	new_tree->num_leaves = 1;
-
-	int *right_spine = (int *)calloc((int)(log((k_num_keys+1)/2)/log((*tree)->max_children/2))+1, sizeof(int));
-
-	BTreeNode *iter = NULL;
-	int i, j;
+	BTreeBuilder builder;
+	BTreeBuilderInit(&builder, (*tree)->max_children);
+	int i;
 	for (i = 0; i < k_num_keys; ++i) {
-		if (new_tree->root->num_children == new_tree->max_children) { // Root needs to be split
-			BTreeNode *new_root = BTreeNodeInitM(true, new_tree->max_children);
-			++new_tree->height;
-			new_root->num_children = 1;
-			new_root->children[0] = new_tree->root;
-			new_tree->root = new_root;
-			BTreeSplitChild(new_tree, new_root, 0);
-			right_spine[new_tree->height] = 1;
-			right_spine[new_tree->height - 1] -= (new_tree->max_children + 1) / 2;
-		}
-		iter = new_tree->root;
-		for (j = new_tree->height; j > 0; j--) { // Split right spine if needs to be split (excluding root)
-			if (iter->children[right_spine[j]]->num_children == new_tree->max_children) { // Need to split
-				BTreeSplitChild(new_tree, iter, right_spine[j]);
-				++right_spine[j];
-				right_spine[j - 1] -= (new_tree->max_children + 1) / 2;
-			}
-			iter = iter->children[right_spine[j]];
-		}
-		if (iter->children != NULL) {
-			iter = iter->children[right_spine[j]];
-		}
-		if (iter->num_children != 0) {
-			iter->keys[iter->num_children - 1] = iter->values[iter->num_children - 1].key;
-		}
-		iter->values[iter->num_children].key = keys[i].key;
-		iter->values[iter->num_children].value = keys[i].id;
-		++iter->num_children;
-		++right_spine[j];
-		++new_tree->number_items;
-	}
-	free(right_spine);
+		BTreeBuilderAppend(&builder, keys[i].key, keys[i].id);
+	}
+	BTree *new_tree = BTreeBuilderFinish(&builder, (*tree)->compress_leaves);
 	BTreeFree(*tree); // Free memory for old tree
 	*tree = new_tree;
 }// For rebuilding before any insertion or deletions (identical to online, just uses key list instead of node list)
 
-static void BTreeSplitChild(BTree *tree, BTreeNode *parent, int child_index) {
+void BTreeRebuildMerge(BTree **tree, BTreeDelta *delta) {
+	// Single sequential pass over the leaves and the sorted delta, delta entries win over leaf values
+	BTreeDeltaSort(delta);
+	BTreeBuilder builder;
+	BTreeBuilderInit(&builder, (*tree)->max_children);
+	BTreeNode *current = (*tree)->min;
+	int i = 0, d = 0;
+	while (current != NULL && i >= current->num_children) { // Skip empty root leaf
+		current = current->next;
+	}
+	while (current != NULL || d < delta->num_entries) {
+		const BTreeDeltaEntry *entry = d < delta->num_entries ? &delta->entries[d] : NULL;
+		if (current != NULL && (entry == NULL || BTreeLeafKey(current, i) < entry->key)) { // Leaf value unchanged
+			BTreeBuilderAppend(&builder, BTreeLeafKey(current, i), BTreeLeafValue(current, i));
+		}
+		else {
+			if (!entry->tombstone) {
+				BTreeBuilderAppend(&builder, entry->key, entry->value);
+			}
+			++d;
+			if (current == NULL || BTreeLeafKey(current, i) != entry->key) { // Leaf value not replaced, keep it for next round
+				continue;
+			}
+		}
+		for (++i; current != NULL && i >= current->num_children; i = 0) { // Advance to next leaf value
+			current = current->next;
+		}
+	}
+	BTreeDeltaClear(delta);
+	BTree *new_tree = BTreeBuilderFinish(&builder, (*tree)->compress_leaves);
+	BTreeFree(*tree); // Free memory for old tree
+	*tree = new_tree;
+}// For folding buffered writes into the tree
+
+static int BTreeLeafMergeDelta(const BTreeNode *leaf, int start, const BTreeDeltaEntry *entries, int num_entries, BTreeValue *merged) {
+	// Writes the values from start on with entries applied to merged, returns how many there are
+	int i = start, e = 0, m = 0;
+	while (i < leaf->num_children || e < num_entries) {
+		if (e == num_entries || (i < leaf->num_children && BTreeLeafKey(leaf, i) < entries[e].key)) { // Leaf value unchanged
+			merged[m].key = BTreeLeafKey(leaf, i);
+			merged[m].value = BTreeLeafValue(leaf, i);
+			++m;
+			++i;
+		}
+		else {
+			if (i < leaf->num_children && BTreeLeafKey(leaf, i) == entries[e].key) { // Replaced or deleted
+				++i;
+			}
+			if (!entries[e].tombstone) {
+				merged[m].key = entries[e].key;
+				merged[m].value = entries[e].value;
+				++m;
+			}
+			++e;
+		}
+	}
+	return m;
+}
+
+void BTreeApplyDelta(BTree *tree, BTreeDelta *delta) {
+	/*
+	 * Applies the delta in key order, walking the leaves it touches left to right.
+	 * A path from the root is kept and only climbed as far as the next key requires, so internal nodes are
+	 * scanned left to right rather than searched from the root per key. Each batch rewrites its leaf once,
+	 * after the first value the entries change.
+	 * Batches are limited to the room left in the leaf. A full leaf is split under its parent and its entries
+	 * batched again, so a long run of keys landing in one leaf fills and splits it as it goes. A leaf that
+	 * would become empty has its entries applied with BTreeDelete, which removes it, and any other overflow
+	 * gets its first entry through BTreeInsert, which splits nodes top down. Either way the path is then
+	 * restarted from the root.
+	 */
+	BTreeDeltaSort(delta);
+	BTreeValue *merged = (BTreeValue *)malloc(2 * tree->max_children * sizeof(BTreeValue)); // A leaf plus at most max_children entries
+	BTreeNode **path = NULL;
+	int *index = NULL; // Child taken at each level of path, only moves right as keys increase
+	int *limit = NULL; // Largest key routed to path[level], valid if limited[level]
+	bool *limited = NULL;
+	int path_size = 0;
+	int depth = -1; // -1 when path must be restarted from the root
+	int d = 0;
+	while (d < delta->num_entries) {
+		int key = delta->entries[d].key;
+		if (tree->root == NULL) { // Empty tree, first insert creates the root
+			Key single = { key, delta->entries[d].value };
+			if (!delta->entries[d].tombstone) {
+				BTreeInsert(tree, &single);
+			}
+			++d;
+			continue;
+		}
+		if (depth < 0) {
+			if (path_size < tree->height + 1) {
+				path_size = tree->height + 1;
+				path = (BTreeNode **)realloc(path, path_size * sizeof(BTreeNode *));
+				index = (int *)realloc(index, path_size * sizeof(int));
+				limit = (int *)realloc(limit, path_size * sizeof(int));
+				limited = (bool *)realloc(limited, path_size * sizeof(bool));
+			}
+			depth = 0;
+			path[0] = tree->root;
+			index[0] = 0;
+			limited[0] = false;
+		}
+		else {
+			while (depth > 0 && limited[depth] && key > limit[depth]) { --depth; } // Climb until the node's range holds key
+		}
+		BTreeNode *current = path[depth];
+		while (!BTREE_IS_LEAF(current)) {
+			int i;
+			for (i = index[depth]; i < current->num_children - 1 && key > current->keys[i]; ++i) {} // Find appropriate child
+			index[depth] = i;
+			path[depth + 1] = current->children[i];
+			index[depth + 1] = 0;
+			limited[depth + 1] = limited[depth];
+			limit[depth + 1] = limit[depth];
+			if (i < current->num_children - 1 && (!limited[depth] || current->keys[i] < limit[depth])) {
+				limited[depth + 1] = true;
+				limit[depth + 1] = current->keys[i];
+			}
+			current = current->children[i];
+			++depth;
+		}
+		// Batch no more entries than can fit, so a burst into one leaf (appends past the largest key) is
+		// merged a bounded number of times instead of once per entry
+		int room = tree->max_children - current->num_children;
+		int last = d + (room > 1 ? room : 1);
+		int end = d + 1;
+		while (end < last && end < delta->num_entries && (!limited[depth] || delta->entries[end].key <= limit[depth])) { ++end; }
+		int start = current->num_children == 0 ? 0 : BTreeLeafSearch(current, key); // Values before start are unchanged
+		int m = start + BTreeLeafMergeDelta(current, start, delta->entries + d, end - d, merged);
+		if (m > tree->max_children && current->num_children == tree->max_children && depth > 0
+			&& path[depth - 1]->num_children < tree->max_children) { // Split in place and descend again from the parent
+			BTreeSplitChild(tree, path[depth - 1], index[depth - 1], key);
+			--depth;
+			continue;
+		}
+		if (m == 0 || m > tree->max_children) { // Leaf must be removed or split
+			// A removed leaf takes all of its entries, an overflowing one only the first, which splits it
+			last = m == 0 ? end : d + 1;
+			for (; d < last; ++d) {
+				Key single = { delta->entries[d].key, delta->entries[d].value };
+				if (delta->entries[d].tombstone) {
+					BTreeDelete(&tree, &single);
+				}
+				else {
+					BTreeInsert(tree, &single);
+				}
+			}
+			depth = -1;
+			continue;
+		}
+		if (current->key_width != 0) {
+			BTreeLeafDecode(tree, current);
+		}
+		int i;
+		for (i = start; i < m; ++i) {
+			current->values[i] = merged[i - start];
+		}
+		for (i = start > 0 ? start - 1 : 0; i < m - 1; ++i) { // keys[start - 1] is new if start was the last value
+			current->keys[i] = current->values[i].key;
+		}
+		tree->number_items += m - current->num_children;
+		current->num_children = m;
+		if (tree->compress_leaves) {
+			BTreeLeafEncode(current);
+		}
+		d = end;
+	}
+	BTreeDeltaClear(delta);
+	free(merged);
+	free(path);
+	free(index);
+	free(limit);
+	free(limited);
+}
+
+BTree * BTreeMerge(const BTree *a, const BTree *b, int max_children) {
+	// Single pass over both leaf lists, b's value wins on equal keys
+	BTreeBuilder builder;
+	BTreeBuilderInit(&builder, max_children);
+	const BTreeNode *left = a->min, *right = b->min;
+	int i = 0, j = 0;
+	while (left != NULL && i >= left->num_children) { // Skip empty root leaf
+		left = left->next;
+	}
+	while (right != NULL && j >= right->num_children) {
+		right = right->next;
+	}
+	while (left != NULL || right != NULL) {
+		int left_key = left != NULL ? BTreeLeafKey(left, i) : 0;
+		int right_key = right != NULL ? BTreeLeafKey(right, j) : 0;
+		if (right == NULL || (left != NULL && left_key < right_key)) {
+			BTreeBuilderAppend(&builder, left_key, BTreeLeafValue(left, i));
+		}
+		else {
+			BTreeBuilderAppend(&builder, right_key, BTreeLeafValue(right, j));
+			for (++j; right != NULL && j >= right->num_children; j = 0) {
+				right = right->next;
+			}
+			if (left == NULL || left_key != right_key) { // Left value not replaced, keep it for next round
+				continue;
+			}
+		}
+		for (++i; left != NULL && i >= left->num_children; i = 0) {
+			left = left->next;
+		}
+	}
+	return BTreeBuilderFinish(&builder, a->compress_leaves);
+}
+
+static void BTreeSplitRecursive(BTree *tree, BTreeNode *current, int key, BTreeNode **left, BTreeNode **right) {
+	/*
+	 * Splits the subtree at current into keys < key (left) and keys >= key (right), either may be NULL.
+	 * Only the nodes on the path to key are cut, every subtree beside the path is moved as is.
+	 * Nodes on the path may be left with few children, which deletion without rebalancing already allows.
+	 */
+	int i, n = current->num_children;
+	if (BTREE_IS_LEAF(current)) {
+		int cut = BTreeLeafSearch(current, key);
+		if (BTreeLeafKey(current, cut) < key) { // Every key in leaf is smaller
+			cut = n;
+		}
+		if (cut == 0) {
+			if (current->previous != NULL) {
+				current->previous->next = NULL;
+			}
+			current->previous = NULL;
+			*left = NULL;
+			*right = current;
+		}
+		else if (cut == n) {
+			if (current->next != NULL) {
+				current->next->previous = NULL;
+			}
+			current->next = NULL;
+			*left = current;
+			*right = NULL;
+		}
+		else { // Cut falls inside this leaf, move the upper part to a new leaf
+			if (current->key_width != 0) {
+				BTreeLeafDecode(tree, current);
+			}
+			BTreeNode *upper = BTreeNodeInitM(false, tree->max_children);
+			for (i = cut; i < n; ++i) {
+				upper->values[i - cut] = current->values[i];
+				if (i < n - 1) {
+					upper->keys[i - cut] = current->values[i].key;
+				}
+			}
+			upper->num_children = n - cut;
+			current->num_children = cut;
+			++tree->num_leaves;
+			upper->next = current->next;
+			if (upper->next != NULL) {
+				upper->next->previous = upper;
+			}
+			current->next = NULL;
+			if (tree->compress_leaves) {
+				BTreeLeafEncode(current);
+				BTreeLeafEncode(upper);
+			}
+			*left = current;
+			*right = upper;
+		}
+		return;
+	}
+	int c;
+	for (c = 0; c < n - 1 && key > current->keys[c]; ++c) {} // Child containing key
+	BTreeNode *child_left, *child_right;
+	BTreeSplitRecursive(tree, current->children[c], key, &child_left, &child_right);
+	BTreeNode *upper = BTreeNodeInitM(true, tree->max_children);
+	int first_key = child_right != NULL ? c : c + 1; // Separator before the first child kept is dropped
+	if (child_right != NULL) {
+		upper->children[upper->num_children++] = child_right;
+	}
+	for (i = c + 1; i < n; ++i) {
+		upper->children[upper->num_children++] = current->children[i];
+	}
+	for (i = first_key; i < n - 1; ++i) {
+		upper->keys[i - first_key] = current->keys[i];
+	}
+	current->num_children = c; // Children before c and their separators stay in place
+	if (child_left != NULL) {
+		current->children[current->num_children++] = child_left;
+	}
+	if (current->num_children == 0) {
+		BTreeNodeFree(current);
+		current = NULL;
+	}
+	if (upper->num_children == 0) {
+		BTreeNodeFree(upper);
+		upper = NULL;
+	}
+	*left = current;
+	*right = upper;
+}
+
+static BTree * BTreeSplitFinish(BTree *tree, BTreeNode *root, int height) {
+	BTree *half = BTreeInitM(tree->max_children);
+	half->compress_leaves = tree->compress_leaves;
+	while (root != NULL && !BTREE_IS_LEAF(root) && root->num_children == 1) { // Collapse roots left with one child
+		BTreeNode *child = root->children[0];
+		BTreeNodeFree(root);
+		root = child;
+		--height;
+	}
+	if (root == NULL) {
+		return half;
+	}
+	half->root = root;
+	half->height = height;
+	BTreeNode *current;
+	for (current = root; !BTREE_IS_LEAF(current); current = current->children[0]) {}
+	half->min = current;
+	return half;
+}
+
+void BTreeSplit(BTree *tree, int key, BTree **left, BTree **right) {
+	BTreeNode *left_root = NULL, *right_root = NULL;
+	if (tree->root != NULL && tree->number_items > 0) {
+		BTreeSplitRecursive(tree, tree->root, key, &left_root, &right_root);
+	}
+	else { // Empty, may still hold an empty root leaf
+		BTreeRecursiveFree(tree->root);
+	}
+	*left = BTreeSplitFinish(tree, left_root, tree->height);
+	*right = BTreeSplitFinish(tree, right_root, tree->height);
+	BTreeNode *current;
+	for (current = (*left)->min; current != NULL; current = current->next) { // Count one side, the other is the rest
+		(*left)->number_items += current->num_children;
+		++(*left)->num_leaves;
+	}
+	if ((*right)->root != NULL) {
+		(*right)->number_items = tree->number_items - (*left)->number_items;
+		(*right)->num_leaves = tree->num_leaves - (*left)->num_leaves;
+	}
+	free(tree); // Nodes now belong to left and right
+}
+
+static void BTreeSplitChild(BTree *tree, BTreeNode *parent, int child_index, int pending_key) {
 	BTreeNode *split = parent->children[child_index];
-	bool is_internal = split->values == NULL; // New node should be leaf if old node was leaf, internal if internal
+	bool is_internal = !BTREE_IS_LEAF(split); // New node should be leaf if old node was leaf, internal if internal
+	if (split->key_width != 0) { // Encoded leaf, restore keys and values before moving them
+		BTreeLeafDecode(tree, split);
+	}
 	BTreeNode *new_node = BTreeNodeInitM(is_internal, tree->max_children);
 	new_node->num_children = (tree->max_children / 2);
 	int i;
@@ -245,11 +718,17 @@ static void BTreeSplitChild(BTree *tree, BTreeNode *parent, int child_index) {
 	++i;
 	parent->keys[i] = split->keys[(tree->max_children + 1) / 2 - 1]; // Child no longer needs this key, belongs to parent
 	++parent->num_children;
+	if (!is_internal && tree->compress_leaves) { // Only re-encode the half pending_key does not go to, the write re-encodes the other
+		BTreeLeafEncode(pending_key > parent->keys[child_index] ? split : new_node);
+	}
 }
 //PRE CONDITIONS: current is nonfull
 static void BTreeInsertRecursive(BTree *tree, BTreeNode *current, const Key *key) {
 	int i = current->num_children - 2; // i = num_keys - 1
-	if (current->values != NULL) { // current is leaf
+	if (BTREE_IS_LEAF(current)) { // current is leaf
+		if (current->key_width != 0) {
+			BTreeLeafDecode(tree, current);
+		}
 		if (key->key > current->values[i + 1].key) { // key should be last child
 			current->values[i + 2].key = key->key;
 			current->values[i + 2].value = key->id;
@@ -258,8 +737,8 @@ static void BTreeInsertRecursive(BTree *tree, BTreeNode *current, const Key *key
 			++tree->number_items;
 		}
 		else if (key->key == current->values[i + 1].key) { // Key replaces last child
-			current->values[i + 2].key = key->key;
-			current->values[i + 2].value = key->id;
+			current->values[i + 1].key = key->key;
+			current->values[i + 1].value = key->id;
 		}
 		else { // Key should not be last child
 			while (i >= 0 && key->key <= current->keys[i]) { i--; }
@@ -292,12 +771,15 @@ static void BTreeInsertRecursive(BTree *tree, BTreeNode *current, const Key *key
 			current->keys[i + 1] = key->key;*/
 			//current->num_children++;
 		}
+		if (tree->compress_leaves) { // Writes decode the leaf, keep it compressed
+			BTreeLeafEncode(current);
+		}
 	}
 	else { // Internal node
 		while (i >= 0 && key->key <= current->keys[i]) { --i; } // Find appropriate node for insertion
 		++i;
 		if (current->children[i]->num_children == tree->max_children) { // Child needs to be split
-			BTreeSplitChild(tree, current, i);
+			BTreeSplitChild(tree, current, i, key->key);
 			if (key->key > current->keys[i]) // If key belongs in new child, increment i
 				++i;
 		}
@@ -316,11 +798,17 @@ void BTreeInsert(BTree *tree, const Key *key) {
 		tree->min = tree->root;// Maintain linked list between leaf nodes (min only changes with deletion)
 		++tree->num_leaves;
 		++tree->number_items;
+		if (tree->compress_leaves) {
+			BTreeLeafEncode(tree->root);
+		}
 	}
 	else if (tree->root->num_children == 1) { // Root must be leaf still
+		if (tree->root->key_width != 0) {
+			BTreeLeafDecode(tree, tree->root);
+		}
 		// Need to perform one more insert before 
 		// num_keys = num_children - 1 and can use recursive call
-		if (key->key < tree->root->keys[0]) { // Belongs before other item (MAY CAUSE ISSUE WITH DELETION ALLOWED)
+		if (key->key < tree->root->values[0].key) { // Belongs before other item
 			tree->root->keys[0] = key->key;
 			tree->root->values[1] = tree->root->values[0];
 			tree->root->values[0].key = key->key;
@@ -328,7 +816,8 @@ void BTreeInsert(BTree *tree, const Key *key) {
 			++tree->root->num_children;
 			++tree->number_items;
 		}
-		else if (key->key > tree->root->keys[0]){ // Belongs after
+		else if (key->key > tree->root->values[0].key){ // Belongs after
+			tree->root->keys[0] = tree->root->values[0].key; // keys[0] may be stale after deletion or rebuild
 			tree->root->values[1].key = key->key;
 			tree->root->values[1].value = key->id;
 			++tree->root->num_children;
@@ -338,6 +827,9 @@ void BTreeInsert(BTree *tree, const Key *key) {
 			tree->root->values[0].key = key->key;
 			tree->root->values[0].value = key->id;
 		}
+		if (tree->compress_leaves) {
+			BTreeLeafEncode(tree->root);
+		}
 	}
 	else { // B-tree is valid, perform normal insert
 		if (tree->root->num_children == tree->max_children) { // Root needs to be split
@@ -346,7 +838,7 @@ void BTreeInsert(BTree *tree, const Key *key) {
 			new_root->num_children = 1;
 			new_root->children[0] = tree->root;
 			tree->root = new_root;
-			BTreeSplitChild(tree, new_root, 0);
+			BTreeSplitChild(tree, new_root, 0, key->key);
 		}
 		BTreeInsertRecursive(tree, tree->root, key);
 	}
@@ -356,14 +848,19 @@ void BTreeInsert(BTree *tree, const Key *key) {
 
 static void BTreeDeleteRecursion(BTree *tree, BTreeNode *current, const Key *key) {
 	int i;
-	for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Locate key
-	if (current->values != NULL) { //Leaf
-		if (current->values[i].key == key->key) { // Found the key
+	if (BTREE_IS_LEAF(current)) { //Leaf
+		i = BTreeLeafSearch(current, key->key); // Locate key
+		if (BTreeLeafKey(current, i) == key->key) { // Found the key
+			if (current->key_width != 0) {
+				BTreeLeafDecode(tree, current);
+			}
 			for (++i; i < current->num_children - 1; ++i) {
 				current->keys[i - 1] = current->keys[i];
 				current->values[i - 1] = current->values[i];
 			}
-			current->values[i - 1] = current->values[i]; // One more value than key
+			if (i < current->num_children) { // Last value has no key, shift it unless it was the one deleted
+				current->values[i - 1] = current->values[i];
+			}
 			current->num_children--;
 			tree->number_items--;
 			if (current == tree->root && current->num_children == 0) { //Tree empty
@@ -373,12 +870,16 @@ static void BTreeDeleteRecursion(BTree *tree, BTreeNode *current, const Key *key
 				tree->height--;
 				tree->num_leaves--;
 			}
+			else if (tree->compress_leaves) { // Empty leaves stay plain, the parent frees them
+				BTreeLeafEncode(current);
+			}
 		}
 	}
 	else { //External Node
+		for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Locate key
 		BTreeDeleteRecursion(tree, current->children[i], key);
 		if (current->children[i]->num_children == 0) { // Need to delete child
-			if (current->children[i]->values != NULL) { // Deleting leaf, update linked list
+			if (BTREE_IS_LEAF(current->children[i])) { // Deleting leaf, update linked list
 				if (current->children[i]->previous == NULL) {
 					tree->min = current->children[i]->next;
 				}
@@ -394,7 +895,9 @@ static void BTreeDeleteRecursion(BTree *tree, BTreeNode *current, const Key *key
 				current->keys[i - 1] = current->keys[i];
 				current->children[i - 1] = current->children[i];
 			}
-			current->children[i - 1] = current->children[i]; // One more value than key
+			if (i < current->num_children) { // One more child than key, shift it unless it was the one deleted
+				current->children[i - 1] = current->children[i];
+			}
 			current->num_children--;
 		}
 		if (current == tree->root && current->num_children == 1) { // Need to delete root
@@ -410,7 +913,11 @@ bool BTreeDeleteBalance(BTree **tree, const Key *key) {
 	if ((*tree)->root == NULL || (*tree)->root->num_children == 0) // Nothing to delete
 		return false;
 	BTreeDeleteRecursion((*tree), (*tree)->root, key);
-	if ((*tree)->height > TREE_HEIGHT_THRESHOLD((*tree)->number_items, (*tree)->max_children)) {
+	if ((*tree)->height != (*tree)->balance_height) { // Height changed, recompute trigger equivalent to TREE_HEIGHT_THRESHOLD
+		(*tree)->balance_height = (*tree)->height;
+		(*tree)->balance_items = BTreeHeightTrigger((*tree)->height, (*tree)->max_children);
+	}
+	if ((*tree)->number_items < (*tree)->balance_items) {
 		//Tree height too great, rebuild
 		BTreeRebuildOnline(tree);
 		return true;
@@ -424,6 +931,20 @@ bool BTreeDeleteBalance(BTree **tree, const Key *key) {
 	//printf("Number items: %d\n", (*tree)->number_items);
 }
 
+static int BTreeHeightTrigger(int height, int max_children) {
+	/*
+	 * Smallest number of items for which height <= TREE_HEIGHT_THRESHOLD(n, b), i.e. the tree is
+	 * rebuilt once n < b * (b/2)^(height-4). Only changes with height, so BTreeDeleteBalance avoids log per delete.
+	 */
+	long long items = max_children;
+	int base = max_children / 2 < 2 ? 2 : max_children / 2;
+	int i;
+	for (i = 4; i < height && items <= INT_MAX; ++i) {
+		items *= base;
+	}
+	return items > INT_MAX ? INT_MAX : (int)items;
+}
+
 void BTreeDelete(BTree **tree, const Key *key) {
 	if ((*tree)->root == NULL || (*tree)->root->num_children == 0) // Nothing to delete
 		return;
@@ -459,13 +980,16 @@ static void BTreePrintRecursive(BTree *tree, BTreeNode *current) {
 	int i;
 
 	for (i = 0; i < current->num_children - 1; ++i) {
-		printf("%d, ", current->keys[i]);
+		printf("%d, ", BTREE_IS_LEAF(current) ? BTreeLeafKey(current, i) : current->keys[i]);
 	}
 
-	if (current->values != NULL) { // Leaf
+	if (BTREE_IS_LEAF(current)) { // Leaf
 		printf("\nValues: ");
 		for (i = 0; i < current->num_children; ++i) {
-			printf("%d:%d, ", current->values[i].key, current->values[i].value);
+			printf("%d:%d, ", BTreeLeafKey(current, i), BTreeLeafValue(current, i));
+		}
+		if (current->key_width != 0) {
+			printf("\nEncoded: base %d, %d bit offsets", current->key_base, 8 * current->key_width);
 		}
 		printf("\nIs leaf? YES\nNext: %d\nPrevious: %d\n", current->next == NULL ? 0 : current->next->id, current->previous == NULL ? 0 : current->previous->id);
 		printf("--------------------------\n");
@@ -528,16 +1052,16 @@ int BTreeFind(BTree *tree, const Key *key) {
 	}
 	BTreeNode *current = tree->root;
 	int i;
-	while (current->values == NULL) { // Until we reach a leaf
+	while (!BTREE_IS_LEAF(current)) { // Until we reach a leaf
 		for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate child
 		current = current->children[i];
 	}
-	for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate value
-	if (current->values[i].key != key->key) {
+	i = BTreeLeafSearch(current, key->key); // Find appropriate value
+	if (BTreeLeafKey(current, i) != key->key) {
 		return -1;
 	}
 	else { // Found the right node
-		return current->values[i].value;
+		return BTreeLeafValue(current, i);
 	}
 }
 
@@ -551,7 +1075,7 @@ int BTreeHeight(BTree *tree) {
 
 static double BTreeAverageNodeSizeRecursive(BTreeNode *current, double *total_nodes) {
 	(*total_nodes)++;
-	if (current->values != NULL) { // Leaf
+	if (BTREE_IS_LEAF(current)) { // Leaf
 		return (double)current->num_children;
 	}
 	else {
@@ -579,25 +1103,25 @@ int BTreeSuccessor(BTree *tree, const Key *key) {
 	}
 	BTreeNode *current = tree->root;
 	int i;
-	while (current->values == NULL) { // Until we reach a leaf
+	while (!BTREE_IS_LEAF(current)) { // Until we reach a leaf
 		for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate child
 		current = current->children[i];
 	}
-	for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate value
-	if (current->values[i].key != key->key) {
+	i = BTreeLeafSearch(current, key->key); // Find appropriate value
+	if (BTreeLeafKey(current, i) != key->key) {
 		return -1; // Node doesn't exist, no successor
 	}
 	else { // Found the right node
 		if (i == current->num_children - 1) { // i is rightmost child, check next node
 			if (current->next != NULL) {
-				return current->next->values[0].value;
+				return BTreeLeafValue(current->next, 0);
 			}
 			else {
 				return -1; // No successor
 			}
 		}
 		else {
-			return current->values[i].value;
+			return BTreeLeafValue(current, i);
 		}
 	}
 }
@@ -608,26 +1132,177 @@ int BTreePredecessor(BTree *tree, const Key *key) {
 	}
 	BTreeNode *current = tree->root;
 	int i;
-	while (current->values == NULL) { // Until we reach a leaf
+	while (!BTREE_IS_LEAF(current)) { // Until we reach a leaf
 		for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate child
 		current = current->children[i];
 	}
-	for (i = 0; i < current->num_children - 1 && key->key > current->keys[i]; ++i) {} // Find appropriate value
-	if (current->values[i].key != key->key) {
+	i = BTreeLeafSearch(current, key->key); // Find appropriate value
+	if (BTreeLeafKey(current, i) != key->key) {
 		return -1; // Node doesn't exist, no predecessor
 	}
 	else { // Found the right node
 		if (i == 0) { // i is leftmost child, check previous node
 			if (current->previous != NULL) {
 				current = current->previous;
-				return current->values[current->num_children - 1].value;
+				return BTreeLeafValue(current, current->num_children - 1);
 			}
 			else {
 				return -1; // No predecessor
 			}
 		}
 		else {
-			return current->values[i].value;
+			return BTreeLeafValue(current, i);
+		}
+	}
+}
+
+static int BTreeLeafSearch(const BTreeNode *leaf, int key) {
+	/*
+	 * Returns the index of the first value whose key is >= key, or num_children - 1 if there is none.
+	 * Matches the linear scan used on internal nodes, for encoded leaves counts offsets below key - key_base.
+	 */
+	int i;
+	if (leaf->key_width == 0) {
+		for (i = 0; i < leaf->num_children - 1 && key > leaf->keys[i]; ++i) {}
+		return i;
+	}
+	long long target = (long long)key - leaf->key_base;
+	if (target <= 0) {
+		return 0;
+	}
+	if (target > BTreeLeafKey(leaf, leaf->num_children - 1) - (long long)leaf->key_base) {
+		return leaf->num_children - 1;
+	}
+	int count = 0; // Offsets are sorted, so count of offsets < target is the index. Padding (all ones) is never < target
+	if (leaf->key_width == 1) {
+		const unsigned char *packed = (const unsigned char *)leaf->packed_keys;
+#ifdef __SSE2__
+		const __m128i flip = _mm_set1_epi8((char)0x80); // SSE2 only has signed compares, flip the sign bit
+		const __m128i t = _mm_set1_epi8((char)(target ^ 0x80));
+		for (i = 0; i < leaf->num_children; i += 16) {
+			__m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(packed + i)), flip);
+			int mask = _mm_movemask_epi8(_mm_cmplt_epi8(block, t));
+			count += __builtin_popcount(mask);
+			if (mask != 0xFFFF) {
+				break;
+			}
+		}
+#else
+		while (count < leaf->num_children && packed[count] < target) { ++count; }
+#endif
+	}
+	else {
+		const unsigned short *packed = (const unsigned short *)leaf->packed_keys;
+#ifdef __SSE2__
+		const __m128i flip = _mm_set1_epi16((short)0x8000);
+		const __m128i t = _mm_set1_epi16((short)(target ^ 0x8000));
+		for (i = 0; i < leaf->num_children; i += 8) {
+			__m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(packed + i)), flip);
+			int mask = _mm_movemask_epi8(_mm_cmplt_epi16(block, t)); // Two mask bits per key
+			count += __builtin_popcount(mask) / 2;
+			if (mask != 0xFFFF) {
+				break;
+			}
+		}
+#else
+		while (count < leaf->num_children && packed[count] < target) { ++count; }
+#endif
+	}
+	return count < leaf->num_children - 1 ? count : leaf->num_children - 1;
+}
+
+static bool BTreeLeafEncode(BTreeNode *leaf) {
+	// Returns false if leaf is empty, already encoded, or its key range does not fit in 16 bits
+	if (leaf->key_width != 0 || leaf->num_children == 0) {
+		return false;
+	}
+	long long range = (long long)leaf->values[leaf->num_children - 1].key - leaf->values[0].key;
+	int width = range <= 0xFF ? 1 : (range <= 0xFFFF ? 2 : 0);
+	if (width == 0) {
+		return false;
+	}
+	int padded = (leaf->num_children * width + 15) / 16 * 16; // SIMD search reads whole 16 byte blocks
+	leaf->ids = (int *)malloc(leaf->num_children * sizeof(int));
+	leaf->packed_keys = malloc(padded);
+	memset(leaf->packed_keys, 0xFF, padded);
+	leaf->key_base = leaf->values[0].key;
+	int i;
+	for (i = 0; i < leaf->num_children; ++i) {
+		if (width == 1) {
+			((unsigned char *)leaf->packed_keys)[i] = (unsigned char)(leaf->values[i].key - leaf->key_base);
+		}
+		else {
+			((unsigned short *)leaf->packed_keys)[i] = (unsigned short)(leaf->values[i].key - leaf->key_base);
+		}
+		leaf->ids[i] = leaf->values[i].value;
+	}
+	leaf->key_width = width;
+	free(leaf->values);
+	free(leaf->keys);
+	leaf->values = NULL;
+	leaf->keys = NULL;
+	return true;
+}
+
+static void BTreeLeafDecode(BTree *tree, BTreeNode *leaf) {
+	if (leaf->key_width == 0) {
+		return;
+	}
+	BTreeValue *values = (BTreeValue *)calloc(tree->max_children, sizeof(BTreeValue));
+	int *keys = (int *)calloc(tree->max_children - 1, sizeof(int));
+	int i;
+	for (i = 0; i < leaf->num_children; ++i) {
+		values[i].key = BTreeLeafKey(leaf, i);
+		values[i].value = leaf->ids[i];
+		if (i < leaf->num_children - 1) {
+			keys[i] = values[i].key;
+		}
+	}
+	free(leaf->ids);
+	free(leaf->packed_keys);
+	leaf->ids = NULL;
+	leaf->packed_keys = NULL;
+	leaf->key_width = 0;
+	leaf->values = values;
+	leaf->keys = keys;
+}
+
+static void BTreeEncodeLeaves(BTree *tree) {
+	if (!tree->compress_leaves) {
+		return;
+	}
+	BTreeNode *current;
+	for (current = tree->min; current != NULL; current = current->next) {
+		BTreeLeafEncode(current);
+	}
+}
+
+void BTreeSetLeafCompression(BTree *tree, bool compress) {
+	tree->compress_leaves = compress;
+	if (compress) {
+		BTreeEncodeLeaves(tree);
+	}
+	else {
+		BTreeNode *current;
+		for (current = tree->min; current != NULL; current = current->next) {
+			BTreeLeafDecode(tree, current);
+		}
+	}
+}
+
+double BTreeLeafBytesPerKey(BTree *tree) {
+	if (tree == NULL || tree->number_items == 0)
+		return 0;
+	double total_bytes = 0;
+	BTreeNode *current;
+	for (current = tree->min; current != NULL; current = current->next) {
+		total_bytes += sizeof(BTreeNode);
+		if (current->key_width == 0) { // Plain leaves are allocated at full capacity
+			total_bytes += tree->max_children * sizeof(BTreeValue) + (tree->max_children - 1) * sizeof(int);
+		}
+		else {
+			total_bytes += current->num_children * sizeof(int) + (current->num_children * current->key_width + 15) / 16 * 16;
 		}
 	}
+	return total_bytes / tree->number_items;
 }
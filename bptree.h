@@ -5,6 +5,7 @@
 #include <stdbool.h>
 
 #define DEFAULT_MAX_CHILDREN 4
+#define BTREE_IS_LEAF(node) ((node)->children == NULL) // Encoded leaves have no values array, so test children
 
 /*
 * Lightweight B+ tree implementation written in C.
@@ -33,12 +34,24 @@ static inline void BTreeValueFree(BTreeValue *value) {
 	free(value);
 }
 
+/*
+* Leaves may optionally be stored encoded (see BTreeSetLeafCompression).
+* An encoded leaf frees values and keys and instead holds exactly num_children ids plus
+* the keys as 8 or 16 bit offsets from key_base (frame of reference), whichever fits the key range.
+* Lookups search the offsets directly (SSE2 when available). A leaf is decoded back to
+* values/keys the first time it is written to, and re-encoded on split and on rebuild.
+*/
+
 typedef struct BTreeNode {
 	BTreeValue *values;
 	struct BTreeNode **children;
 	struct BTreeNode *next;
 	struct BTreeNode *previous;
 	int *keys;
+	int *ids; // Values of an encoded leaf, NULL otherwise
+	void *packed_keys; // Keys of an encoded leaf as offsets from key_base, padded to 16 bytes
+	int key_base;
+	int key_width; // Bytes per packed key, 0 if leaf is not encoded
 	int num_children;
 	int id;
 } BTreeNode;
@@ -54,14 +67,60 @@ typedef struct BTree {
 	int height;
 	int number_items;
 	int num_leaves;
+	bool compress_leaves;
+	int balance_height; // Height balance_items was computed for
+	int balance_items; // BTreeDeleteBalance rebuilds when number_items falls below this
 } BTree;
 
+/*
+* Small buffer of pending writes, deletes are kept as tombstones.
+* Entries are appended and found through an open addressing hash index, so puts and finds are O(1).
+* Entries are sorted only when applied, by BTreeApplyDelta or BTreeRebuildMerge.
+*/
+
+typedef struct BTreeDeltaEntry {
+	int key;
+	int value;
+	bool tombstone;
+} BTreeDeltaEntry;
+
+typedef struct BTreeDelta {
+	BTreeDeltaEntry *entries; // Arrival order, at most one entry per key
+	int *index; // Hash table of positions in entries, -1 if slot is empty
+	int index_bits; // log2 of hash table size
+	int num_entries;
+	int capacity;
+} BTreeDelta;
+
+BTreeDelta * BTreeDeltaInit(int capacity);
+void BTreeDeltaFree(BTreeDelta *delta);
+void BTreeDeltaClear(BTreeDelta *delta);
+bool BTreeDeltaPut(BTreeDelta *delta, int key, int value, bool tombstone); // Returns false if key is new and delta is full
+const BTreeDeltaEntry * BTreeDeltaFind(const BTreeDelta *delta, int key); // NULL if key has no pending write
+
+/*
+* Bulk loader used by all rebuilds. Appends go to the rightmost leaf, splitting the right spine as it fills.
+*/
+
+typedef struct BTreeBuilder {
+	BTree *tree;
+	int *right_spine; // Index of the rightmost child at each level, tree is only ever appended to on the right
+	int spine_size;
+} BTreeBuilder;
+
 BTree * BTreeInit();
 BTree * BTreeInitM(int max_children);
 void BTreeRecursiveFree(BTreeNode *node);
 void BTreeFree(BTree *tree);
 void BTreeRebuildOnline(BTree **tree);// For rebuilding after insertions or deletions
 void BTreeRebuildOffline(BTree **tree, const Key *keys, const int k_num_keys); //Rebuilds assuming that keys is sorted
+void BTreeRebuildMerge(BTree **tree, BTreeDelta *delta); // Rebuilds with delta applied, leaves delta empty
+void BTreeApplyDelta(BTree *tree, BTreeDelta *delta); // Applies delta in place to the leaves it touches, leaves delta empty
+BTree * BTreeMerge(const BTree *a, const BTree *b, int max_children); // New tree holding both, b wins on equal keys
+void BTreeSplit(BTree *tree, int key, BTree **left, BTree **right); // Consumes tree, left gets keys < key
+void BTreeBuilderInit(BTreeBuilder *builder, int max_children);
+void BTreeBuilderAppend(BTreeBuilder *builder, int key, int value); // Keys must be appended in increasing order
+BTree * BTreeBuilderFinish(BTreeBuilder *builder, bool compress_leaves);
 void BTreeInsert(BTree *tree, const Key *key);
 bool BTreeDeleteBalance(BTree **tree, const Key *key);
 void BTreeDelete(BTree **tree, const Key *key);
@@ -71,5 +130,7 @@ int BTreePredecessor(BTree *tree, const Key *key);
 int BTreeHeight(BTree *tree);
 void BTreePrint(BTree *tree);
 double BTreeAverageNodeSize(BTree *tree);
+void BTreeSetLeafCompression(BTree *tree, bool compress); // Encodes or decodes every leaf now, later splits and rebuilds follow the setting
+double BTreeLeafBytesPerKey(BTree *tree); // Leaf node bytes (header, keys and values) divided by number of items
 
 #endif